@@ -3,10 +3,17 @@
 nasal_lexer    lexer;
 nasal_parse    parse;
 nasal_import   import;
+nasal_optimizer optimizer;
 std::string    inputfile="null";
 nasal_runtime  runtime;
 nasal_codegen  code_generator;
 nasal_bytecode_vm bytevm;
+bool           show_gc_stat=false;
+bool           heap_dump=false;
+bool           reg_mode=false;
+bool           profile=false;
+bool           optimize=true;
+nasal_heap_analyzer heap_analyzer;
 
 void help()
 {
@@ -19,6 +26,17 @@ void help()
 	std::cout<<">> [run   ] run abstract syntax tree.\n";
 	std::cout<<">> [code  ] show byte code.\n";
 	std::cout<<">> [exec  ] execute program on bytecode vm.\n";
+	std::cout<<">> [reg   ] switch on/off register-based bytecode of code and exec.\n";
+	std::cout<<">> [opt   ] switch on/off folding constants and removing dead code before code and exec.\n";
+	std::cout<<">> [gcstat] switch on/off printing heap statistics after exec.\n";
+	std::cout<<">> [prof  ] switch on/off counting opcodes of exec,counts of all runs are printed when it is off.\n";
+	std::cout<<">> [dump  ] switch on/off writing heap snapshot to \"file\".heap after exec.\n";
+	std::cout<<">> [limit ] set heap limit of exec by [units] [bytes],0 means no limit.\n";
+	std::cout<<">> [nursery] set size of young generation of exec by [units].\n";
+	std::cout<<">> [budget] set work of each major gc step of exec by [units],0 means stop-the-world.\n";
+	std::cout<<">>          steps do more work when old space grows during collection or heap limit is reached,\n";
+	std::cout<<">>          minor gc is not limited,gcstat shows the longest pause.\n";
+	std::cout<<">> [heap  ] analyze heap snapshot in the input file,or in \"file\".heap written by dump.\n";
 	std::cout<<">> [logo  ] print logo of nasal .\n";
 	std::cout<<">> [exit  ] quit nasal interpreter.\n";
 	return;
@@ -131,6 +149,8 @@ void show_bytecode()
 		die("import",inputfile);
 		return;
 	}
+	if(optimize)
+		optimizer.do_optimization(import.get_root());
 	code_generator.main_progress(import.get_root());
 	code_generator.print_byte_code();
 	return;
@@ -158,11 +178,17 @@ void execute()
 		die("import",inputfile);
 		return;
 	}
+	if(optimize)
+		optimizer.do_optimization(import.get_root());
 	code_generator.main_progress(import.get_root());
+	bytevm.set_heap_dump(heap_dump? inputfile+".heap":"");
 	bytevm.run(
 		code_generator.get_string_table(),
 		code_generator.get_number_table(),
-		code_generator.get_exec_code()
+		code_generator.get_exec_code(),
+		code_generator.get_symbol_table(),
+		code_generator.get_capture_table(),
+		code_generator.get_reg_table()
 	);
 	return;
 }
@@ -220,6 +246,70 @@ int main()
 			show_bytecode();
 		else if(command=="exec")
 			execute();
+		else if(command=="gcstat")
+		{
+			show_gc_stat=!show_gc_stat;
+			bytevm.set_show_gc_stat(show_gc_stat);
+			std::cout<<">> [gcstat] "<<(show_gc_stat? "on":"off")<<".\n";
+		}
+		else if(command=="reg")
+		{
+			reg_mode=!reg_mode;
+			code_generator.set_register_mode(reg_mode);
+			std::cout<<">> [reg   ] "<<(reg_mode? "on":"off")<<".\n";
+		}
+		else if(command=="opt")
+		{
+			optimize=!optimize;
+			std::cout<<">> [opt   ] "<<(optimize? "on":"off")<<".\n";
+		}
+		else if(command=="prof")
+		{
+			profile=!profile;
+			bytevm.set_profile(profile);
+			std::cout<<">> [prof  ] "<<(profile? "on":"off")<<".\n";
+			if(!profile)
+				bytevm.print_profile(20);
+		}
+		else if(command=="dump")
+		{
+			heap_dump=!heap_dump;
+			std::cout<<">> [dump  ] "<<(heap_dump? "on":"off")<<".\n";
+		}
+		else if(command=="limit")
+		{
+			int units=0;
+			long long bytes=0;
+			std::cin>>units>>bytes;
+			bytevm.set_heap_limit(units,bytes);
+			std::cout<<">> [limit ] "<<units<<" units,"<<bytes<<" bytes.\n";
+		}
+		else if(command=="nursery")
+		{
+			int units=0;
+			std::cin>>units;
+			bytevm.set_nursery_size(units);
+			std::cout<<">> [nursery] "<<(units>0? units:1)<<" units.\n";
+		}
+		else if(command=="budget")
+		{
+			int units=0;
+			std::cin>>units;
+			bytevm.set_gc_step_budget(units);
+			std::cout<<">> [budget] "<<(units>0? units:0)<<" units.\n";
+		}
+		else if(command=="heap")
+		{
+			// after dump and exec the input file is still the script,its snapshot is beside it
+			std::string snapshot=inputfile;
+			if(!heap_analyzer.is_snapshot(snapshot) && heap_analyzer.is_snapshot(inputfile+".heap"))
+				snapshot=inputfile+".heap";
+			if(heap_analyzer.load(snapshot))
+			{
+				heap_analyzer.analyze();
+				heap_analyzer.report(10);
+			}
+		}
 		else if(command=="logo")
 			logo();
 		else if(command=="exit")
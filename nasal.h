@@ -23,7 +23,9 @@
 #include "nasal_ast.h"
 #include "nasal_parse.h"
 #include "nasal_import.h"
+#include "nasal_optimizer.h"
 #include "nasal_gc.h"
+#include "nasal_heap.h"
 #include "nasal_builtin.h"
 #include "nasal_runtime.h"
 #include "nasal_codegen.h"
@@ -119,6 +119,7 @@ nasal_ast::nasal_ast()
 {
     this->line=0;
     this->type=ast_null;
+    this->num=0;
     return;
 }
 
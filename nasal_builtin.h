@@ -55,6 +55,10 @@ int builtin_die_state;// used in builtin_die
 int builtin_die(int,nasal_virtual_machine&);
 int builtin_type(int,nasal_virtual_machine&);
 int builtin_substr(int,nasal_virtual_machine&);
+int builtin_gcstat(int,nasal_virtual_machine&);
+int builtin_heapdump(int,nasal_virtual_machine&);
+int builtin_gcidle(int,nasal_virtual_machine&);
+int builtin_gcbudget(int,nasal_virtual_machine&);
 
 // register builtin function's name and it's address here in this table below
 // this table must and with {"",NULL}
@@ -100,6 +104,10 @@ struct FUNC_TABLE
     {"nasal_call_builtin_die",           builtin_die},
     {"nasal_call_builtin_type",          builtin_type},
     {"nasal_call_builtin_substr",        builtin_substr},
+    {"nasal_call_builtin_gc_stat",       builtin_gcstat},
+    {"nasal_call_builtin_heap_dump",     builtin_heapdump},
+    {"nasal_call_builtin_gc_idle",       builtin_gcidle},
+    {"nasal_call_builtin_gc_budget",     builtin_gcbudget},
     {"",                                 NULL}
 };
 
@@ -130,7 +138,7 @@ int builtin_print(int local_scope_addr,nasal_virtual_machine& nasal_vm)
     }
     std::cout<<"\n";
     // generate return value
-    int ret_addr=nasal_vm.gc_alloc(vm_nil);
+    int ret_addr=nasal_vm.gc_box_nil();
     return ret_addr;
 }
 int builtin_append(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -147,6 +155,7 @@ int builtin_append(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         std::cout<<">> [runtime] builtin_append: \"elements\" has wrong value type(must be vector).\n";
         return -1;
     }
+    nasal_vm.gc_write_barrier(vector_value_addr);
     nasal_vector& ref_vector=nasal_vm.gc_get(vector_value_addr).get_vector();
     nasal_vector& ref_elements=nasal_vm.gc_get(elem_value_addr).get_vector();
     int size=ref_elements.size();
@@ -156,7 +165,7 @@ int builtin_append(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         nasal_vm.add_reference(value_address);
         ref_vector.add_elem(value_address);
     }
-    int ret_addr=nasal_vm.gc_alloc(vm_nil);
+    int ret_addr=nasal_vm.gc_box_nil();
     return ret_addr;
 }
 int builtin_setsize(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -184,7 +193,7 @@ int builtin_setsize(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         number=(int)nasal_vm.gc_get(size_value_addr).get_number();
     else
     {
-        std::string str=nasal_vm.gc_get(size_value_addr).get_string();
+        const std::string& str=nasal_vm.gc_get(size_value_addr).get_string();
         double tmp=trans_string_to_number(str);
         if(std::isnan(tmp))
         {
@@ -198,6 +207,7 @@ int builtin_setsize(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         std::cout<<">> [runtime] builtin_setsize: size must be greater than -1.\n";
         return -1;
     }
+    nasal_vm.gc_write_barrier(vector_value_addr);
     nasal_vector& ref_vector=nasal_vm.gc_get(vector_value_addr).get_vector();
     int vec_size=ref_vector.size();
     if(number<vec_size)
@@ -210,10 +220,10 @@ int builtin_setsize(int local_scope_addr,nasal_virtual_machine& nasal_vm)
     else if(number>vec_size)
         for(int i=vec_size;i<number;++i)
         {
-            int new_val_addr=nasal_vm.gc_alloc(vm_nil);
+            int new_val_addr=nasal_vm.gc_box_nil();
             ref_vector.add_elem(new_val_addr);
         }
-    int ret_addr=nasal_vm.gc_alloc(vm_nil);
+    int ret_addr=nasal_vm.gc_box_nil();
     return ret_addr;
 }
 
@@ -225,7 +235,7 @@ int builtin_system(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         std::cout<<">> [runtime] builtin_system: \"str\" has wrong value type(must be string).\n";
         return -1;
     }
-    std::string str=nasal_vm.gc_get(str_value_addr).get_string();
+    const std::string& str=nasal_vm.gc_get(str_value_addr).get_string();
     int size=str.length();
     char* command=new char[size+1];
     for(int i=0;i<size;++i)
@@ -233,7 +243,7 @@ int builtin_system(int local_scope_addr,nasal_virtual_machine& nasal_vm)
     command[size]='\0';
     system(command);
     delete []command;
-    int ret_addr=nasal_vm.gc_alloc(vm_nil);
+    int ret_addr=nasal_vm.gc_box_nil();
     return ret_addr;
 }
 
@@ -257,7 +267,7 @@ int builtin_sleep(int local_scope_addr,nasal_virtual_machine& nasal_vm)
     unsigned long sleep_time=0;
     if(nasal_vm.gc_get(value_addr).get_type()==vm_string)
     {
-        std::string str=nasal_vm.gc_get(value_addr).get_string();
+        const std::string& str=nasal_vm.gc_get(value_addr).get_string();
         double number=trans_string_to_number(str);
         if(std::isnan(number))
         {
@@ -268,7 +278,7 @@ int builtin_sleep(int local_scope_addr,nasal_virtual_machine& nasal_vm)
     else
         sleep_time=(unsigned long)nasal_vm.gc_get(value_addr).get_number();
     sleep(sleep_time); // sleep in unistd.h will make this progress sleep sleep_time seconds.
-    int ret_addr=nasal_vm.gc_alloc(vm_nil);
+    int ret_addr=nasal_vm.gc_box_nil();
     return ret_addr;
 }
 
@@ -280,7 +290,7 @@ int builtin_finput(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         std::cout<<">> [runtime] builtin_finput: \"filename\" has wrong value type(must be string).\n";
         return -1;
     }
-    std::string filename=nasal_vm.gc_get(value_addr).get_string();
+    const std::string& filename=nasal_vm.gc_get(value_addr).get_string();
     std::ifstream fin(filename);
     std::string file_content="";
     if(!fin.fail())
@@ -313,12 +323,12 @@ int builtin_foutput(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         std::cout<<">> [runtime] builtin_foutput: \"str\" has wrong value type(must be string).\n";
         return -1;
     }
-    std::string filename=nasal_vm.gc_get(value_addr).get_string();
-    std::string file_content=nasal_vm.gc_get(str_value_addr).get_string();
+    const std::string& filename=nasal_vm.gc_get(value_addr).get_string();
+    const std::string& file_content=nasal_vm.gc_get(str_value_addr).get_string();
     std::ofstream fout(filename);
     fout<<file_content;
     fout.close();
-    int ret_addr=nasal_vm.gc_alloc(vm_nil);
+    int ret_addr=nasal_vm.gc_box_nil();
     return ret_addr;
 }
 
@@ -336,8 +346,8 @@ int builtin_split(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         std::cout<<">> [runtime] builtin_split: \"string\" has wrong value type(must be string).\n";
         return -1;
     }
-    std::string delimeter=nasal_vm.gc_get(delimeter_value_addr).get_string();
-    std::string source=nasal_vm.gc_get(string_value_addr).get_string();
+    const std::string& delimeter=nasal_vm.gc_get(delimeter_value_addr).get_string();
+    const std::string& source=nasal_vm.gc_get(string_value_addr).get_string();
     int delimeter_len=delimeter.length();
     int source_len=source.length();
 
@@ -401,14 +411,13 @@ int builtin_rand(int local_scope_addr,nasal_virtual_machine& nasal_vm)
     {
         unsigned int number=(unsigned int)nasal_vm.gc_get(value_addr).get_number();
         srand(number);
-        int ret_addr=nasal_vm.gc_alloc(vm_nil);
+        int ret_addr=nasal_vm.gc_box_nil();
         return ret_addr;
     }
     double num=0;
     for(int i=0;i<5;++i)
         num=(num+rand())*(1.0/(RAND_MAX+1.0));
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number(num);
+    int ret_addr=nasal_vm.gc_box_number(num);
     return ret_addr;
 }
 int builtin_id(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -419,8 +428,7 @@ int builtin_id(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         std::cout<<">> [runtime] builtin_id: cannot find \"thing\".\n";
         return -1;
     }
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number((double)value_addr);
+    int ret_addr=nasal_vm.gc_box_number((double)value_addr);
     return ret_addr;
 }
 int builtin_int(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -432,8 +440,7 @@ int builtin_int(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         return -1;
     }
     int number=(int)nasal_vm.gc_get(value_addr).get_number();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number((double)number);
+    int ret_addr=nasal_vm.gc_box_number((double)number);
     return ret_addr;
 }
 int builtin_num(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -444,9 +451,8 @@ int builtin_num(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         std::cout<<">> [runtime] builtin_num: \"value\" has wrong value type(must be string).\n";
         return -1;
     }
-    std::string str=nasal_vm.gc_get(value_addr).get_string();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number(trans_string_to_number(str));
+    const std::string& str=nasal_vm.gc_get(value_addr).get_string();
+    int ret_addr=nasal_vm.gc_box_number(trans_string_to_number(str));
     return ret_addr;
 }
 int builtin_pop(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -469,7 +475,7 @@ int builtin_str(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         return -1;
     }
     double number=nasal_vm.gc_get(value_addr).get_number();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
+    int ret_addr=nasal_vm.gc_alloc(vm_string);
     nasal_vm.gc_get(ret_addr).set_string(trans_number_to_string(number));
     return ret_addr;
 }
@@ -495,12 +501,9 @@ int builtin_size(int local_scope_addr,nasal_virtual_machine& nasal_vm)
     }
     int ret_addr=-1;
     if(number<0)
-        ret_addr=nasal_vm.gc_alloc(vm_nil);
+        ret_addr=nasal_vm.gc_box_nil();
     else
-    {
-        ret_addr=nasal_vm.gc_alloc(vm_number);
-        nasal_vm.gc_get(ret_addr).set_number((double)number);
-    }
+        ret_addr=nasal_vm.gc_box_number((double)number);
     return ret_addr;
 }
 int builtin_xor(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -519,8 +522,7 @@ int builtin_xor(int local_scope_addr,nasal_virtual_machine& nasal_vm)
     }
     int number_a=(int)nasal_vm.gc_get(a_addr).get_number();
     int number_b=(int)nasal_vm.gc_get(b_addr).get_number();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number((double)(number_a^number_b));
+    int ret_addr=nasal_vm.gc_box_number((double)(number_a^number_b));
     return ret_addr;
 }
 int builtin_and(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -539,8 +541,7 @@ int builtin_and(int local_scope_addr,nasal_virtual_machine& nasal_vm)
     }
     int number_a=(int)nasal_vm.gc_get(a_addr).get_number();
     int number_b=(int)nasal_vm.gc_get(b_addr).get_number();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number((double)(number_a&number_b));
+    int ret_addr=nasal_vm.gc_box_number((double)(number_a&number_b));
     return ret_addr;
 }
 int builtin_or(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -559,8 +560,7 @@ int builtin_or(int local_scope_addr,nasal_virtual_machine& nasal_vm)
     }
     int number_a=(int)nasal_vm.gc_get(a_addr).get_number();
     int number_b=(int)nasal_vm.gc_get(b_addr).get_number();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number((double)(number_a|number_b));
+    int ret_addr=nasal_vm.gc_box_number((double)(number_a|number_b));
     return ret_addr;
 }
 int builtin_nand(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -579,8 +579,7 @@ int builtin_nand(int local_scope_addr,nasal_virtual_machine& nasal_vm)
     }
     int number_a=(int)nasal_vm.gc_get(a_addr).get_number();
     int number_b=(int)nasal_vm.gc_get(b_addr).get_number();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number((double)(~(number_a&number_b)));
+    int ret_addr=nasal_vm.gc_box_number((double)(~(number_a&number_b)));
     return ret_addr;
 }
 int builtin_not(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -592,8 +591,7 @@ int builtin_not(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         return -1;
     }
     int number=(int)nasal_vm.gc_get(a_addr).get_number();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number((double)(~number));
+    int ret_addr=nasal_vm.gc_box_number((double)(~number));
     return ret_addr;
 }
 int builtin_sin(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -605,8 +603,7 @@ int builtin_sin(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         return -1;
     }
     double number=nasal_vm.gc_get(value_addr).get_number();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number(sin(number));
+    int ret_addr=nasal_vm.gc_box_number(sin(number));
     return ret_addr;
 }
 int builtin_cos(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -618,8 +615,7 @@ int builtin_cos(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         return -1;
     }
     double number=nasal_vm.gc_get(value_addr).get_number();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number(cos(number));
+    int ret_addr=nasal_vm.gc_box_number(cos(number));
     return ret_addr;
 }
 int builtin_tan(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -631,8 +627,7 @@ int builtin_tan(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         return -1;
     }
     double number=nasal_vm.gc_get(value_addr).get_number();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number(tan(number));
+    int ret_addr=nasal_vm.gc_box_number(tan(number));
     return ret_addr;
 }
 int builtin_exp(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -644,8 +639,7 @@ int builtin_exp(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         return -1;
     }
     double number=nasal_vm.gc_get(value_addr).get_number();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number(exp(number));
+    int ret_addr=nasal_vm.gc_box_number(exp(number));
     return ret_addr;
 }
 int builtin_ln(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -657,8 +651,7 @@ int builtin_ln(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         return -1;
     }
     double number=nasal_vm.gc_get(value_addr).get_number();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number(log(number)/log(2.7182818284590452354));
+    int ret_addr=nasal_vm.gc_box_number(log(number)/log(2.7182818284590452354));
     return ret_addr;
 }
 int builtin_sqrt(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -670,8 +663,7 @@ int builtin_sqrt(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         return -1;
     }
     double number=nasal_vm.gc_get(value_addr).get_number();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number(sqrt(number));
+    int ret_addr=nasal_vm.gc_box_number(sqrt(number));
     return ret_addr;
 }
 int builtin_atan2(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -690,8 +682,7 @@ int builtin_atan2(int local_scope_addr,nasal_virtual_machine& nasal_vm)
     }
     double x=nasal_vm.gc_get(x_value_addr).get_number();
     double y=nasal_vm.gc_get(y_value_addr).get_number();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number(atan2(y,x));
+    int ret_addr=nasal_vm.gc_box_number(atan2(y,x));
     return ret_addr;
 }
 int builtin_time(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -703,8 +694,7 @@ int builtin_time(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         return -1;
     }
     time_t begin_time=(time_t)nasal_vm.gc_get(value_addr).get_number();
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number((double)time(&begin_time));
+    int ret_addr=nasal_vm.gc_box_number((double)time(&begin_time));
     return ret_addr;
 }
 int builtin_contains(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -721,10 +711,9 @@ int builtin_contains(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         std::cout<<">> [runtime] builtin_contains: \"key\" has wrong type(must be string).\n";
         return -1;
     }
-    std::string key=nasal_vm.gc_get(key_addr).get_string();
-    bool contains=nasal_vm.gc_get(hash_addr).get_hash().check_contain(key);
-    int ret_addr=nasal_vm.gc_alloc(vm_number);
-    nasal_vm.gc_get(ret_addr).set_number((double)contains);
+    const std::string& key=nasal_vm.gc_get(key_addr).get_string();
+    bool contains=nasal_vm.gc_get(hash_addr).get_hash().check_contain(key,nasal_vm.gc_string_hash(key_addr));
+    int ret_addr=nasal_vm.gc_box_number((double)contains);
     return ret_addr;
 }
 int builtin_delete(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -741,9 +730,9 @@ int builtin_delete(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         std::cout<<">> [runtime] builtin_delete: \"key\" has wrong type(must be string).\n";
         return -1;
     }
-    std::string key=nasal_vm.gc_get(key_addr).get_string();
+    const std::string& key=nasal_vm.gc_get(key_addr).get_string();
     nasal_vm.gc_get(hash_addr).get_hash().del_elem(key);
-    int ret_addr=nasal_vm.gc_alloc(vm_nil);
+    int ret_addr=nasal_vm.gc_box_nil();
     return ret_addr;
 }
 int builtin_getkeys(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -762,7 +751,7 @@ int builtin_import(int local_scope_addr,nasal_virtual_machine& nasal_vm)
     // this function is used in preprocessing.
     // this function will return nothing when running.
     std::cout<<">> [runtime] builtin_import: cannot use import when running.\n";
-    int ret_addr=nasal_vm.gc_alloc(vm_nil);
+    int ret_addr=nasal_vm.gc_box_nil();
     return ret_addr;
 }
 int builtin_die(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -775,7 +764,7 @@ int builtin_die(int local_scope_addr,nasal_virtual_machine& nasal_vm)
     }
     builtin_die_state=1;
     std::cout<<">> [runtime] error: "<<nasal_vm.gc_get(str_addr).get_string()<<'\n';
-    int ret_addr=nasal_vm.gc_alloc(vm_nil);
+    int ret_addr=nasal_vm.gc_box_nil();
     return ret_addr;
 }
 int builtin_type(int local_scope_addr,nasal_virtual_machine& nasal_vm)
@@ -819,7 +808,7 @@ int builtin_substr(int local_scope_addr,nasal_virtual_machine& nasal_vm)
         std::cout<<">> [runtime] builtin_substr: cannot find \"length\" or wrong type(must be number).\n";
         return -1;
     }
-    std::string str=nasal_vm.gc_get(str_addr).get_string();
+    const std::string& str=nasal_vm.gc_get(str_addr).get_string();
     int begin=(int)nasal_vm.gc_get(begin_addr).get_number();
     int len=(int)nasal_vm.gc_get(length_addr).get_number();
     if(begin>=str.length() || begin+len>=str.length())
@@ -834,4 +823,101 @@ int builtin_substr(int local_scope_addr,nasal_virtual_machine& nasal_vm)
     nasal_vm.gc_get(ret_addr).set_string(tmp);
     return ret_addr;
 }
-#endif
\ No newline at end of file
+int builtin_gcstat(int local_scope_addr,nasal_virtual_machine& nasal_vm)
+{
+    // get stat before allocating the result,so the result is not counted
+    nasal_gc_stat info=nasal_vm.gc_stat();
+    const char* type_name[]={"nil","number","string","closure","function","vector","hash"};
+    const char* count_name[]={"alloc","free","live"};
+    int ret_addr=nasal_vm.gc_alloc(vm_hash);
+    nasal_hash& ref_hash=nasal_vm.gc_get(ret_addr).get_hash();
+    for(int i=0;i<3;++i)
+    {
+        int count_addr=nasal_vm.gc_alloc(vm_hash);
+        nasal_hash& ref_count=nasal_vm.gc_get(count_addr).get_hash();
+        for(int j=0;j<=vm_hash;++j)
+        {
+            double count;
+            if(i==0)
+                count=(double)info.alloc_count[j];
+            else if(i==1)
+                count=(double)info.free_count[j];
+            else
+                count=(double)info.live_count[j];
+            ref_count.add_elem(type_name[j],nasal_vm.gc_box_number(count));
+        }
+        ref_hash.add_elem(count_name[i],count_addr);
+    }
+    struct
+    {
+        const char* name;
+        double value;
+    }info_table[]=
+    {
+        {"live_bytes",      (double)info.live_bytes},
+        {"live_units",      (double)info.live_units},
+        {"peak_live_units", (double)info.peak_live_units},
+        {"heap_units",      (double)info.heap_units},
+        {"free_list",       (double)info.free_list},
+        {"nursery_used",    (double)info.nursery_used},
+        {"nursery_size",    (double)info.nursery_size},
+        {"remembered",      (double)info.remembered},
+        {"pool_size",       (double)info.pool_size},
+        {"minor_count",     (double)info.minor_count},
+        {"major_count",     (double)info.major_count},
+        {"gc_time",         info.gc_time},
+        {"max_pause",       info.max_pause},
+        {"max_step_work",   (double)info.max_step_work},
+        {"over_budget",     (double)info.over_budget},
+        {"parents_hit",     (double)info.parents_hit},
+        {"parents_miss",    (double)info.parents_miss}
+    };
+    for(int i=0;i<(int)(sizeof(info_table)/sizeof(info_table[0]));++i)
+    {
+        int num_addr=nasal_vm.gc_box_number(info_table[i].value);
+        ref_hash.add_elem(info_table[i].name,num_addr);
+    }
+    return ret_addr;
+}
+int builtin_heapdump(int local_scope_addr,nasal_virtual_machine& nasal_vm)
+{
+    int value_addr=in_builtin_find("filename");
+    if(value_addr<0 || !in_builtin_check(value_addr,vm_string))
+    {
+        std::cout<<">> [runtime] builtin_heapdump: \"filename\" has wrong value type(must be string).\n";
+        return -1;
+    }
+    // roots of interpreter are given by root provider,caller's scope is added in case it is not set
+    std::vector<int> roots;
+    roots.push_back(local_scope_addr);
+    nasal_vm.gc_roots(roots);
+    bool result=nasal_vm.gc_dump(nasal_vm.gc_get(value_addr).get_string(),roots);
+    int ret_addr=nasal_vm.gc_box_number((double)result);
+    return ret_addr;
+}
+int builtin_gcidle(int local_scope_addr,nasal_virtual_machine& nasal_vm)
+{
+    int value_addr=in_builtin_find("units");
+    if(value_addr<0 || !in_builtin_check(value_addr,vm_number))
+    {
+        std::cout<<">> [runtime] builtin_gcidle: \"units\" has wrong value type(must be number).\n";
+        return -1;
+    }
+    // bytecode vm does the work after this call returns,roots are not known here
+    nasal_vm.gc_idle((int)nasal_vm.gc_get(value_addr).get_number());
+    int ret_addr=nasal_vm.gc_box_nil();
+    return ret_addr;
+}
+int builtin_gcbudget(int local_scope_addr,nasal_virtual_machine& nasal_vm)
+{
+    int value_addr=in_builtin_find("units");
+    if(value_addr<0 || !in_builtin_check(value_addr,vm_number))
+    {
+        std::cout<<">> [runtime] builtin_gcbudget: \"units\" has wrong value type(must be number).\n";
+        return -1;
+    }
+    nasal_vm.set_gc_step_budget((int)nasal_vm.gc_get(value_addr).get_number());
+    int ret_addr=nasal_vm.gc_box_nil();
+    return ret_addr;
+}
+#endif
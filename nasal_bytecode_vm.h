@@ -1,6 +1,151 @@
 #ifndef __NASAL_BYTECODE_VM_H__
 #define __NASAL_BYTECODE_VM_H__
 
+// dispatch loop uses labels as values if the compiler supports it,define NASAL_NO_COMPUTED_GOTO to use switch
+#if defined(__GNUC__) && !defined(NASAL_NO_COMPUTED_GOTO)
+#define NASAL_COMPUTED_GOTO
+#endif
+
+/*
+nasal_inline_cache: result of the last lookup of callh/mcallh at one place of byte codes
+a member of the hash itself is found by (shape,slot) and shape is enough to check it
+a member found in parents is (owner,slot),it is used when the hash has the same shape and parents[0],
+and parents have not been changed since the cache was filled
+*/
+struct nasal_inline_cache
+{
+    nasal_shape* shape;          // NULL means empty
+    nasal_hash*  parent;
+    nasal_hash*  owner;          // NULL if member is in the hash itself
+    int slot;
+    unsigned int epoch;
+    nasal_inline_cache()
+    {
+        shape=NULL;
+        parent=owner=NULL;
+        slot=-1;
+        epoch=0;
+        return;
+    }
+};
+
+/*
+nasal_name_cache: result of the last lookup of call/mcall at one place of byte codes
+closures made by the same function share the table of captured names,so (table,slot) is enough for a name in closure
+a name in global scope is (table,slot) when the table does not have this name,
+and the version of global scope must not be changed since the cache was filled
+*/
+struct nasal_name_cache
+{
+    const nasal_hashmap* table;            // table of closure,NULL if running function has no closure
+    int slot;                              // -1 means empty
+    bool global;
+    unsigned int version;
+    nasal_name_cache()
+    {
+        table=NULL;
+        slot=-1;
+        global=false;
+        version=0;
+        return;
+    }
+};
+
+/*
+nasal_mem_slot: place given by mcall/mcallv/mcallh to assignments
+numbers in packed vector have no address,so this place is stored as vector and index
+*/
+struct nasal_mem_slot
+{
+    int* addr;
+    nasal_vector* vec;
+    int index;
+    nasal_mem_slot(int* mem_addr)
+    {
+        addr=mem_addr;
+        vec=NULL;
+        index=0;
+        return;
+    }
+    nasal_mem_slot(nasal_vector* vec_ptr,int vec_index)
+    {
+        addr=NULL;
+        vec=vec_ptr;
+        index=vec_index;
+        return;
+    }
+};
+
+/*
+nasal_call_frame: activation record of one function call
+local values of the call are in frame_stack[base,base+size of table),
+closure of the function only keeps values captured when the function was made
+*/
+struct nasal_call_frame
+{
+    int closure;                           // closure of the function,-1 in global scope
+    int base;                              // begin of local slots in frame_stack
+    int ret;                               // place of callf to return
+    const nasal_hashmap* table;            // names of local slots
+    nasal_call_frame(int closure_addr,int frame_base,int ret_ptr,const nasal_hashmap* names)
+    {
+        closure=closure_addr;
+        base=frame_base;
+        ret=ret_ptr;
+        table=names;
+        return;
+    }
+};
+
+/*
+nasal_op_profile: counts of opcodes and sequences of 2 and 3 opcodes in the order they are executed
+counts are kept until clear(),so one profile can cover runs of many scripts
+count is allocated by the first clear(),a vm that never profiles does not pay for it
+*/
+struct nasal_op_profile
+{
+    int prev[2];                 // last two opcodes,-1 means none
+    std::vector<long long> count;// count[op],count[op1*size+op2] and count[(op1*size+op2)*size+op3] are in three parts
+    long long total;
+    nasal_op_profile()
+    {
+        total=0;
+        new_run();
+        return;
+    }
+    void clear()
+    {
+        const int size=op_exit+1;
+        if(count.empty())
+            count.resize(size+size*size+size*size*size,0);
+        else
+            std::fill(count.begin(),count.end(),0);
+        total=0;
+        new_run();
+        return;
+    }
+    void new_run()
+    {
+        // sequences do not cross two runs
+        prev[0]=prev[1]=-1;
+        return;
+    }
+    void add(int op)
+    {
+        const int size=op_exit+1;
+        ++total;
+        ++count[op];
+        if(prev[1]>=0)
+            ++count[size+prev[1]*size+op];
+        if(prev[0]>=0)
+            ++count[size+size*size+(prev[0]*size+prev[1])*size+op];
+        prev[0]=prev[1];
+        prev[1]=op;
+        return;
+    }
+    void print(int);
+};
+
 class nasal_bytecode_vm
 {
 private:
@@ -9,30 +154,74 @@ private:
     int global_scope_addr;
     // garbage collector and memory manager
     nasal_virtual_machine vm;
+    // nursery size given by set_nursery_size,0 means no change
+    int nursery_size;
+    // heap statistics of the last run,printed after running if show_gc_stat is true
+    bool show_gc_stat;
+    nasal_gc_stat last_gc_stat;
+    // heap snapshot is written to this file after running,empty string means no snapshot
+    std::string heap_dump_file;
+    // opcodes are counted in op_profile if profile is true
+    bool profile;
+    nasal_op_profile op_profile;
     // byte codes store here
     std::vector<opcode> exec_code;
     // main calculation stack
-    std::stack<int> value_stack;
-    // local scope for function block
-    std::stack<int> local_scope_stack;
+    // value_stack,call_frame,frame_stack and slice_stack are roots of mark-sweep
+    std::vector<nasal_ref> value_stack;
+    // slot pointer stack for mcall/mcallv/mcallh
+    std::stack<nasal_mem_slot> mem_stack;
+    // frames of running functions,call_frame[0] is global scope
+    std::vector<nasal_call_frame> call_frame;
+    // local slots of all frames,-1 means the value is not defined yet
+    std::vector<int> frame_stack;
     // slice stack for vec[val,val,val:val]
-    std::stack<int> slice_stack;
-    // ptr stack stores address for function to return
-    std::stack<int> call_stack;
+    std::vector<int> slice_stack;
     // iterator stack for forindex/foreach
     std::stack<int> counter_stack;
     // string table
     std::vector<std::string> string_table;
+    // names of slots given by codegen,symbol_table[0] is used by global scope
+    // scopes share these tables,so they are indexed once when loaded
+    std::vector<nasal_hashmap> symbol_table;
+    // names captured by functions,functions with no captured name have no closure
+    std::vector<nasal_hashmap> capture_table;
+    // scope lent to builtins,they find arguments in it by name
+    int builtin_scope_addr;
+    // addresses of interned strings in string table,pushstr uses them without allocation
+    std::vector<int> string_addr;
+    // hashes of strings in string table,hash keys in callh/mcallh/hashapp are not hashed again
+    std::vector<unsigned int> string_hash;
+    // inline caches of callh/mcallh,inline_cache[i] is used by exec_code[i]
+    std::vector<nasal_inline_cache> inline_cache;
+    // name caches of call/mcall,name_cache[i] is used by exec_code[i]
+    std::vector<nasal_name_cache> name_cache;
     // number table
     std::vector<double> number_table;
-    // opcode -> function address table
-    std::vector<void (nasal_bytecode_vm::*)()> opr_table;
+    // operands of register opcodes
+    std::vector<opreg> reg_table;
     // builtin function address table
     std::map<std::string,int (*)(int x,nasal_virtual_machine& vm)> builtin_func_hashmap;
     void die(std::string);
-    bool check_condition(int);
+    void collect_garbage(int budget=-1);
+    static void gc_roots(void*,std::vector<int>&);
+    nasal_ref gc_to_ref(int);
+    int  ref_to_gc(nasal_ref);
+    double ref_to_number(nasal_ref&);
+    bool check_condition(nasal_ref&);
+    void set_me(int,int);
+    int  hash_member(nasal_hash&);// value address of member string_table[exec_code[ptr].index] by inline cache
+    nasal_ref mem_load(nasal_mem_slot&);
+    void mem_store(nasal_mem_slot&,nasal_ref);
+    int  local_value_address(int);// value of local slot,found by name if it is not defined yet
+    int* local_mem_address(int);  // memory of local slot,found by name if it is not defined yet
+    int* name_mem_address(int&);  // memory of name used by call/mcall and address of its closure
+    bool ref_equal(nasal_ref&,nasal_ref&);
+    nasal_ref reg_load(reg_operand&);
+    void reg_store(reg_operand&,nasal_ref);
     void opr_nop();
-    void opr_load();
+    void opr_loadg();
+    void opr_loadl();
     void opr_pushnum();
     void opr_pushone();
     void opr_pushzero();
@@ -74,6 +263,8 @@ private:
     void opr_forindex();
     void opr_foreach();
     void opr_call();
+    void opr_callg();
+    void opr_calll();
     void opr_callv();
     void opr_callvi();
     void opr_callh();
@@ -84,110 +275,156 @@ private:
     void opr_slice();
     void opr_slice2();
     void opr_mcall();
+    void opr_mcallg();
+    void opr_mcalll();
     void opr_mcallv();
     void opr_mcallh();
     void opr_return();
+    void opr_rmov();
+    void opr_radd();
+    void opr_rsub();
+    void opr_rmul();
+    void opr_rdiv();
+    void opr_rjf();
+    void opr_pone_mcalll_addeq_pop();
+    void opr_less_jf_pop();
+    void opr_mcalll_addeq_pop();
+    void opr_mcalll_meq_pop();
+    void opr_jf_pop();
+    void opr_calll_calll();
+    void opr_callb_ret();
+    void opr_pop_jmp();
 public:
     nasal_bytecode_vm();
     ~nasal_bytecode_vm();
     void clear();
-    void run(std::vector<std::string>&,std::vector<double>&,std::vector<opcode>&);
+    void set_gc_step_budget(int);
+    void set_nursery_size(int);  // size of young generation,used from the next run
+    void set_heap_limit(int,long long);
+    void set_show_gc_stat(bool);
+    void set_heap_dump(std::string);
+    void set_profile(bool);      // count opcodes and sequences of them,counts are cleared when it is switched on
+    void print_profile(int);     // print the most frequent n opcodes,pairs and triples
+    nasal_gc_stat get_gc_stat();
+    void run(std::vector<std::string>&,std::vector<double>&,std::vector<opcode>&,std::vector<std::vector<std::string> >&,std::vector<std::vector<std::string> >&,std::vector<opreg>&);
 };
 
+void nasal_op_profile::print(int n)
+{
+    const int size=op_exit+1;
+    const char* title[3]={"opcode","pair","triple"};
+    int begin[4]={0,size,size+size*size,size+size*size+size*size*size};
+    std::cout<<">> [profile] "<<total<<" opcodes executed.\n";
+    if(count.empty())
+        return;
+    for(int k=0;k<3;++k)
+    {
+        std::vector<std::pair<long long,int> > sorted;
+        for(int i=begin[k];i<begin[k+1];++i)
+            if(count[i])
+                sorted.push_back(std::pair<long long,int>(-count[i],i-begin[k]));
+        std::sort(sorted.begin(),sorted.end());
+        std::cout<<">> [profile] most frequent "<<title[k]<<":\n";
+        for(int i=0;i<n && i<(int)sorted.size();++i)
+        {
+            // decode opcodes of the sequence from the index
+            int ops[3];
+            int seq=sorted[i].second;
+            for(int j=k;j>=0;--j)
+            {
+                ops[j]=seq%size;
+                seq/=size;
+            }
+            std::cout<<"   "<<(double)(-sorted[i].first)*100/total<<"% "<<-sorted[i].first<<" ";
+            for(int j=0;j<=k;++j)
+                for(int t=0;code_table[t].name;++t)
+                    if(code_table[t].type==ops[j])
+                        std::cout<<code_table[t].name<<" ";
+            std::cout<<"\n";
+        }
+    }
+    return;
+}
 nasal_bytecode_vm::nasal_bytecode_vm()
 {
-    local_scope_stack.push(-1);
+    vm.set_tracing(true);
+    vm.set_root_provider(gc_roots,this);
+    show_gc_stat=false;
+    profile=false;
+    nursery_size=0;
+    call_frame.push_back(nasal_call_frame(-1,0,0,NULL));
 
-    struct
-    {
-        int op;
-        void (nasal_bytecode_vm::*ptr)();
-    }function_table[]=
-    {
-        {op_nop,         nasal_bytecode_vm::opr_nop},
-        {op_load,        nasal_bytecode_vm::opr_load},
-        {op_pushnum,     nasal_bytecode_vm::opr_pushnum},
-        {op_pushone,     nasal_bytecode_vm::opr_pushone},
-        {op_pushzero,    nasal_bytecode_vm::opr_pushzero},
-        {op_pushnil,     nasal_bytecode_vm::opr_pushnil},
-        {op_pushstr,     nasal_bytecode_vm::opr_pushstr},
-        {op_newvec,      nasal_bytecode_vm::opr_newvec},
-        {op_newhash,     nasal_bytecode_vm::opr_newhash},
-        {op_newfunc,     nasal_bytecode_vm::opr_newfunc},
-        {op_vecapp,      nasal_bytecode_vm::opr_vecapp},
-        {op_hashapp,     nasal_bytecode_vm::opr_hashapp},
-        {op_para,        nasal_bytecode_vm::opr_para},
-        {op_defpara,     nasal_bytecode_vm::opr_defpara},
-        {op_dynpara,     nasal_bytecode_vm::opr_dynpara},
-        {op_entry,       nasal_bytecode_vm::opr_entry},
-        {op_unot,        nasal_bytecode_vm::opr_unot},
-        {op_usub,        nasal_bytecode_vm::opr_usub},
-        {op_add,         nasal_bytecode_vm::opr_add},
-        {op_sub,         nasal_bytecode_vm::opr_sub},
-        {op_mul,         nasal_bytecode_vm::opr_mul},
-        {op_div,         nasal_bytecode_vm::opr_div},
-        {op_lnk,         nasal_bytecode_vm::opr_lnk},
-        {op_addeq,       nasal_bytecode_vm::opr_addeq},
-        {op_subeq,       nasal_bytecode_vm::opr_subeq},
-        {op_muleq,       nasal_bytecode_vm::opr_muleq},
-        {op_diveq,       nasal_bytecode_vm::opr_diveq},
-        {op_lnkeq,       nasal_bytecode_vm::opr_lnkeq},
-        {op_meq,         nasal_bytecode_vm::opr_meq},
-        {op_eq,          nasal_bytecode_vm::opr_eq},
-        {op_neq,         nasal_bytecode_vm::opr_neq},
-        {op_less,        nasal_bytecode_vm::opr_less},
-        {op_leq,         nasal_bytecode_vm::opr_leq},
-        {op_grt,         nasal_bytecode_vm::opr_grt},
-        {op_geq,         nasal_bytecode_vm::opr_geq},
-        {op_pop,         nasal_bytecode_vm::opr_pop},
-        {op_jmp,         nasal_bytecode_vm::opr_jmp},
-        {op_jmptrue,     nasal_bytecode_vm::opr_jmptrue},
-        {op_jmpfalse,    nasal_bytecode_vm::opr_jmpfalse},
-        {op_counter,     nasal_bytecode_vm::opr_counter},
-        {op_forindex,    nasal_bytecode_vm::opr_forindex},
-        {op_foreach,     nasal_bytecode_vm::opr_foreach},
-        {op_call,        nasal_bytecode_vm::opr_call},
-        {op_callv,       nasal_bytecode_vm::opr_callv},
-        {op_callvi,      nasal_bytecode_vm::opr_callvi},
-        {op_callh,       nasal_bytecode_vm::opr_callh},
-        {op_callf,       nasal_bytecode_vm::opr_callf},
-        {op_builtincall, nasal_bytecode_vm::opr_builtincall},
-        {op_slicebegin,  nasal_bytecode_vm::opr_slicebegin},
-        {op_sliceend,    nasal_bytecode_vm::opr_sliceend},
-        {op_slice,       nasal_bytecode_vm::opr_slice},
-        {op_slice2,      nasal_bytecode_vm::opr_slice2},
-        {op_mcall,       nasal_bytecode_vm::opr_mcall},
-        {op_mcallv,      nasal_bytecode_vm::opr_mcallv},
-        {op_mcallh,      nasal_bytecode_vm::opr_mcallh},
-        {op_return,      nasal_bytecode_vm::opr_return},
-        {-1,NULL}
-    };
-    for(int i=0;function_table[i].ptr;++i)
-        opr_table.push_back(NULL);
-    for(int i=0;function_table[i].ptr;++i)
-        opr_table[function_table[i].op]=function_table[i].ptr;
     for(int i=0;builtin_func_table[i].func_pointer;++i)
         builtin_func_hashmap[builtin_func_table[i].func_name]=builtin_func_table[i].func_pointer;
     return;
 }
 nasal_bytecode_vm::~nasal_bytecode_vm()
 {
-    opr_table.clear();
     return;
 }
 void nasal_bytecode_vm::clear()
 {
     vm.clear();
     global_scope_addr=-1;
-    while(!value_stack.empty())value_stack.pop();
-    while(!local_scope_stack.empty())local_scope_stack.pop();
-    local_scope_stack.push(-1);
-    while(!slice_stack.empty())slice_stack.pop();
-    while(!call_stack.empty())call_stack.pop();
+    value_stack.clear();
+    while(!mem_stack.empty())mem_stack.pop();
+    call_frame.clear();
+    call_frame.push_back(nasal_call_frame(-1,0,0,NULL));
+    frame_stack.clear();
+    slice_stack.clear();
     while(!counter_stack.empty())counter_stack.pop();
     string_table.clear();
+    string_addr.clear();
+    string_hash.clear();
+    inline_cache.clear();
+    name_cache.clear();
     number_table.clear();
+    reg_table.clear();
     exec_code.clear();
+    symbol_table.clear();
+    capture_table.clear();
+    builtin_scope_addr=-1;
+    return;
+}
+void nasal_bytecode_vm::set_gc_step_budget(int budget)
+{
+    vm.set_gc_step_budget(budget);
+    return;
+}
+void nasal_bytecode_vm::set_nursery_size(int size)
+{
+    nursery_size=size;
+    return;
+}
+void nasal_bytecode_vm::set_heap_limit(int units,long long bytes)
+{
+    vm.set_heap_limit(units,bytes);
+    return;
+}
+void nasal_bytecode_vm::set_show_gc_stat(bool enable)
+{
+    show_gc_stat=enable;
+    return;
+}
+void nasal_bytecode_vm::set_profile(bool enable)
+{
+    if(enable && !profile)
+        op_profile.clear();
+    profile=enable;
+    return;
+}
+void nasal_bytecode_vm::print_profile(int n)
+{
+    op_profile.print(n);
+    return;
+}
+nasal_gc_stat nasal_bytecode_vm::get_gc_stat()
+{
+    return last_gc_stat;
+}
+void nasal_bytecode_vm::set_heap_dump(std::string filename)
+{
+    heap_dump_file=filename;
     return;
 }
 void nasal_bytecode_vm::die(std::string str)
@@ -204,788 +441,741 @@ void nasal_bytecode_vm::die(std::string str)
     std::cout<<">> [vm] 0x"<<numinfo<<": "<<str<<'\n';
     return;
 }
-bool nasal_bytecode_vm::check_condition(int value_addr)
+void nasal_bytecode_vm::collect_garbage(int budget)
 {
-    if(value_addr<0)
-        return false;
-    int type=vm.gc_get(value_addr).get_type();
-    if(type==vm_nil || type==vm_vector || type==vm_hash || type==vm_function)
-        return false;
-    else if(type==vm_string)
+    clock_t begin_time=clock();
+    // roots are updated to the new address of promoted values
+    global_scope_addr=vm.gc_promote(global_scope_addr);
+    builtin_scope_addr=vm.gc_promote(builtin_scope_addr);
+    for(std::vector<nasal_call_frame>::iterator i=call_frame.begin();i!=call_frame.end();++i)
+        i->closure=vm.gc_promote(i->closure);
+    for(std::vector<int>::iterator i=frame_stack.begin();i!=frame_stack.end();++i)
+        *i=vm.gc_promote(*i);
+    for(std::vector<nasal_ref>::iterator i=value_stack.begin();i!=value_stack.end();++i)
+        if(i->in_gc())
+            i->value.addr=vm.gc_promote(i->value.addr);
+    for(std::vector<int>::iterator i=slice_stack.begin();i!=slice_stack.end();++i)
+        *i=vm.gc_promote(*i);
+    vm.gc_minor();
+    if(!vm.gc_need_major())
     {
-        std::string str=vm.gc_get(value_addr).get_string();
+        vm.gc_count_pause(begin_time);
+        return;
+    }
+    vm.gc_mark(global_scope_addr);
+    vm.gc_mark(builtin_scope_addr);
+    for(std::vector<nasal_call_frame>::iterator i=call_frame.begin();i!=call_frame.end();++i)
+        if(i->closure>=0)
+            vm.gc_mark(i->closure);
+    for(std::vector<int>::iterator i=frame_stack.begin();i!=frame_stack.end();++i)
+        if(*i>=0)
+            vm.gc_mark(*i);
+    for(std::vector<nasal_ref>::iterator i=value_stack.begin();i!=value_stack.end();++i)
+        if(i->in_gc())
+            vm.gc_mark(i->value.addr);
+    for(std::vector<int>::iterator i=slice_stack.begin();i!=slice_stack.end();++i)
+        vm.gc_mark(*i);
+    // with gc step budget set,major collection is finished in several calls of collect_garbage
+    vm.gc_major_step(budget);
+    vm.gc_count_pause(begin_time);
+    return;
+}
+void nasal_bytecode_vm::gc_roots(void* obj,std::vector<int>& roots)
+{
+    // used by gc when roots are needed out of collect_garbage,for example in builtin_heapdump
+    nasal_bytecode_vm& bytevm=*(nasal_bytecode_vm*)obj;
+    roots.push_back(bytevm.global_scope_addr);
+    roots.push_back(bytevm.builtin_scope_addr);
+    for(std::vector<nasal_call_frame>::iterator i=bytevm.call_frame.begin();i!=bytevm.call_frame.end();++i)
+        if(i->closure>=0)
+            roots.push_back(i->closure);
+    for(std::vector<int>::iterator i=bytevm.frame_stack.begin();i!=bytevm.frame_stack.end();++i)
+        if(*i>=0)
+            roots.push_back(*i);
+    for(std::vector<nasal_ref>::iterator i=bytevm.value_stack.begin();i!=bytevm.value_stack.end();++i)
+        if(i->in_gc())
+            roots.push_back(i->value.addr);
+    roots.insert(roots.end(),bytevm.slice_stack.begin(),bytevm.slice_stack.end());
+    return;
+}
+nasal_ref nasal_bytecode_vm::gc_to_ref(int value_addr)
+{
+    // nil and number are unboxed and stored in nasal_ref directly
+    // other types share the same address
+    nasal_scalar& ref=vm.gc_get(value_addr);
+    int type=ref.get_type();
+    if(type==vm_nil)
+        return nasal_ref();
+    else if(type==vm_number)
+        return nasal_ref(ref.get_number());
+    return nasal_ref(type,value_addr);
+}
+void nasal_bytecode_vm::set_me(int func_addr,int hash_addr)
+{
+    // functions capturing nothing get closure when they are called as methods at the first time
+    nasal_function& ref=vm.gc_get(func_addr).get_func();
+    if(ref.get_closure_addr()<0)
+    {
+        vm.gc_write_barrier(func_addr);
+        ref.bind_closure_addr(vm.gc_alloc(vm_closure));
+    }
+    vm.gc_write_barrier(ref.get_closure_addr());
+    vm.gc_get(ref.get_closure_addr()).get_closure().add_new_value("me",hash_addr);
+    return;
+}
+int nasal_bytecode_vm::hash_member(nasal_hash& ref)
+{
+    nasal_inline_cache& cache=inline_cache[ptr];
+    nasal_shape* shape=ref.get_shape();
+    if(shape==cache.shape)
+    {
+        if(!cache.owner)
+            return ref.get_slot_value(cache.slot);
+        if(cache.epoch==vm.gc_shape_epoch() && ref.get_first_parent()==cache.parent)
+            return cache.owner->get_slot_value(cache.slot);
+    }
+    const std::string& key=string_table[exec_code[ptr].index];
+    unsigned int h=string_hash[exec_code[ptr].index];
+    int slot;
+    nasal_hash* owner=ref.get_owner(key,h,slot);
+    if(!owner)
+        return -1;
+    int res=owner->get_slot_value(slot);
+    // shape of dictionary mode may change in place
+    if(shape->dict)
+        return res;
+    if(owner==&ref)
+    {
+        cache.shape=shape;
+        cache.owner=NULL;
+        cache.slot=slot;
+        return res;
+    }
+    // member in parents is cached only if it is found in parents[0],so checking parents[0] is enough
+    nasal_hash* parent=ref.get_first_parent();
+    int parent_slot;
+    if(parent && parent->get_owner(key,h,parent_slot)==owner && parent_slot==slot)
+    {
+        cache.shape=shape;
+        cache.parent=parent;
+        cache.owner=owner;
+        cache.slot=slot;
+        cache.epoch=vm.gc_shape_epoch();
+    }
+    return res;
+}
+nasal_ref nasal_bytecode_vm::mem_load(nasal_mem_slot& slot)
+{
+    if(!slot.addr)
+    {
+        if(slot.vec->is_packed())
+            return nasal_ref(slot.vec->get_number(slot.index));
+        return gc_to_ref(slot.vec->get_value_address(slot.index));
+    }
+    return gc_to_ref(*slot.addr);
+}
+void nasal_bytecode_vm::mem_store(nasal_mem_slot& slot,nasal_ref value)
+{
+    if(!slot.addr)
+    {
+        // vector may be unpacked after the slot is given
+        if(slot.vec->is_packed() && value.type==vm_number)
+        {
+            slot.vec->set_number(slot.index,value.value.num);
+            return;
+        }
+        int* mem_addr=slot.vec->get_mem_address(slot.index);
+        if(mem_addr)
+            *mem_addr=ref_to_gc(value);
+        return;
+    }
+    *slot.addr=ref_to_gc(value);
+    return;
+}
+int nasal_bytecode_vm::local_value_address(int index)
+{
+    nasal_call_frame& frame=call_frame.back();
+    int val_addr=frame_stack[frame.base+index];
+    if(val_addr>=0)
+        return val_addr;
+    // not defined yet in this call,so it is found by name like opr_call
+    const std::string& name=frame.table->keys[index];
+    if(frame.closure>=0)
+        val_addr=vm.gc_get(frame.closure).get_closure().get_value_address(name);
+    if(val_addr<0)
+        val_addr=vm.gc_get(global_scope_addr).get_closure().get_value_address(name);
+    if(val_addr<0)
+        die("call: cannot find symbol named \""+name+"\"");
+    return val_addr;
+}
+int* nasal_bytecode_vm::local_mem_address(int index)
+{
+    nasal_call_frame& frame=call_frame.back();
+    int* mem_addr=&frame_stack[frame.base+index];
+    if(*mem_addr>=0)
+        return mem_addr;
+    // slots of frame_stack are roots,only closures need the write barrier
+    int closure_addr=frame.closure;
+    const std::string& name=frame.table->keys[index];
+    mem_addr=closure_addr>=0? vm.gc_get(closure_addr).get_closure().get_mem_address(name):NULL;
+    if(!mem_addr)
+    {
+        closure_addr=global_scope_addr;
+        mem_addr=vm.gc_get(closure_addr).get_closure().get_mem_address(name);
+    }
+    if(!mem_addr)
+    {
+        die("mcall: cannot find symbol named \""+name+"\"");
+        return NULL;
+    }
+    vm.gc_write_barrier(closure_addr);
+    return mem_addr;
+}
+int* nasal_bytecode_vm::name_mem_address(int& closure_addr)
+{
+    nasal_name_cache& cache=name_cache[ptr];
+    closure_addr=call_frame.back().closure;
+    nasal_scope* scope=closure_addr>=0? vm.gc_get(closure_addr).get_closure().get_single_scope():NULL;
+    // closure with its own names or more than one scope is not cached
+    bool cacheable=closure_addr<0 || (scope && scope->table);
+    const nasal_hashmap* table=scope? scope->table:NULL;
+    nasal_closure& global=vm.gc_get(global_scope_addr).get_closure();
+    if(cacheable && cache.slot>=0 && cache.table==table)
+    {
+        if(!cache.global)
+        {
+            if(scope->slots[cache.slot]>=0)
+                return &scope->slots[cache.slot];
+        }
+        else if(cache.version==global.get_version())
+        {
+            int* mem_addr=&global.get_single_scope()->slots[cache.slot];
+            if(*mem_addr>=0)
+            {
+                closure_addr=global_scope_addr;
+                return mem_addr;
+            }
+        }
+    }
+    // cache missed,search by name and fill the cache
+    const std::string& name=string_table[exec_code[ptr].index];
+    int* mem_addr=closure_addr>=0? vm.gc_get(closure_addr).get_closure().get_mem_address(name):NULL;
+    if(mem_addr)
+    {
+        if(cacheable)
+        {
+            cache.table=table;
+            cache.slot=mem_addr-&scope->slots[0];
+            cache.global=false;
+        }
+        return mem_addr;
+    }
+    closure_addr=global_scope_addr;
+    mem_addr=global.get_mem_address(name);
+    // name defined later in the closure must not be hidden by the cache
+    nasal_scope* global_scope=global.get_single_scope();
+    if(mem_addr && cacheable && global_scope && (!scope || scope->find(name,nasal_hashmap::hash(name))<0))
+    {
+        cache.table=table;
+        cache.slot=mem_addr-&global_scope->slots[0];
+        cache.global=true;
+        cache.version=global.get_version();
+    }
+    return mem_addr;
+}
+bool nasal_bytecode_vm::ref_equal(nasal_ref& val1,nasal_ref& val2)
+{
+    int a_type=val1.type;
+    int b_type=val2.type;
+    if(a_type==vm_nil && b_type==vm_nil)
+        return true;
+    else if(a_type==vm_string && b_type==vm_string)
+        return val1.value.addr==val2.value.addr||vm.gc_get(val1.value.addr).get_string()==vm.gc_get(val2.value.addr).get_string();
+    else if((a_type==vm_number || a_type==vm_string) && (b_type==vm_number || b_type==vm_string))
+        return ref_to_number(val1)==ref_to_number(val2);
+    else if(val1.in_gc() && val2.in_gc())
+        return val1.value.addr==val2.value.addr;
+    return false;
+}
+nasal_ref nasal_bytecode_vm::reg_load(reg_operand& opr)
+{
+    // error is set if the slot is not defined
+    int val_addr=-1;
+    switch(opr.type)
+    {
+        case reg_number:
+            return nasal_ref(number_table[opr.index]);
+        case reg_local:
+        case reg_new_local:
+            val_addr=local_value_address(opr.index);
+            break;
+        case reg_global:
+        case reg_new_global:
+        {
+            nasal_closure& ref=vm.gc_get(global_scope_addr).get_closure();
+            val_addr=ref.get_local(opr.index);
+            if(val_addr<0)
+                die("call: cannot find symbol named \""+ref.get_local_name(opr.index)+"\"");
+            break;
+        }
+    }
+    return val_addr<0? nasal_ref():gc_to_ref(val_addr);
+}
+void nasal_bytecode_vm::reg_store(reg_operand& opr,nasal_ref value)
+{
+    // new slots are defined like loadl/loadg,others are assigned like mcalll/mcallg
+    switch(opr.type)
+    {
+        case reg_new_local:
+            frame_stack[call_frame.back().base+opr.index]=ref_to_gc(value);
+            break;
+        case reg_local:
+        {
+            int* mem_addr=local_mem_address(opr.index);
+            if(mem_addr)
+                *mem_addr=ref_to_gc(value);
+            break;
+        }
+        case reg_new_global:
+            vm.gc_write_barrier(global_scope_addr);
+            vm.gc_get(global_scope_addr).get_closure().set_local(opr.index,ref_to_gc(value));
+            break;
+        case reg_global:
+        {
+            nasal_closure& ref=vm.gc_get(global_scope_addr).get_closure();
+            int* mem_addr=ref.get_local_mem(opr.index);
+            if(!mem_addr)
+            {
+                die("mcall: cannot find symbol named \""+ref.get_local_name(opr.index)+"\"");
+                break;
+            }
+            vm.gc_write_barrier(global_scope_addr);
+            *mem_addr=ref_to_gc(value);
+            break;
+        }
+    }
+    return;
+}
+int nasal_bytecode_vm::ref_to_gc(nasal_ref value)
+{
+    // box the value so that it can be stored in vector/hash/closure
+    // nil,small integers and constants share pinned boxes,so storing them does not allocate
+    if(value.type==vm_nil)
+        return vm.gc_box_nil();
+    else if(value.type==vm_number)
+        return vm.gc_box_number(value.value.num);
+    return value.value.addr;
+}
+double nasal_bytecode_vm::ref_to_number(nasal_ref& value)
+{
+    if(value.type==vm_number)
+        return value.value.num;
+    else if(value.type==vm_string)
+        return trans_string_to_number(vm.gc_get(value.value.addr).get_string());
+    return (1/0.0)+(-1/0.0);
+}
+bool nasal_bytecode_vm::check_condition(nasal_ref& value)
+{
+    int type=value.type;
+    if(type==vm_string)
+    {
+        const std::string& str=vm.gc_get(value.value.addr).get_string();
         double number=trans_string_to_number(str);
         if(std::isnan(number))
             return str.length()!=0;
         return (number!=0);
     }
     else if(type==vm_number)
-        return (vm.gc_get(value_addr).get_number()!=0);
+        return (value.value.num!=0);
     return false;
 }
 void nasal_bytecode_vm::opr_nop()
 {
     return;
 }
-void nasal_bytecode_vm::opr_load()
+void nasal_bytecode_vm::opr_loadg()
 {
-    int val_addr=value_stack.top();
-    value_stack.pop();
-    if(local_scope_stack.top()>=0)
-        vm.gc_get(local_scope_stack.top()).get_closure().add_new_value(string_table[exec_code[ptr].index],val_addr);
-    else
-        vm.gc_get(global_scope_addr).get_closure().add_new_value(string_table[exec_code[ptr].index],val_addr);
+    int val_addr=ref_to_gc(value_stack.back());
+    value_stack.pop_back();
+    vm.gc_write_barrier(global_scope_addr);
+    vm.gc_get(global_scope_addr).get_closure().set_local(exec_code[ptr].index,val_addr);
+    return;
+}
+void nasal_bytecode_vm::opr_loadl()
+{
+    frame_stack[call_frame.back().base+exec_code[ptr].index]=ref_to_gc(value_stack.back());
+    value_stack.pop_back();
     return;
 }
 void nasal_bytecode_vm::opr_pushnum()
 {
-    int val_addr=vm.gc_alloc(vm_number);
-    vm.gc_get(val_addr).set_number(number_table[exec_code[ptr].index]);
-    value_stack.push(val_addr);
+    value_stack.push_back(nasal_ref(number_table[exec_code[ptr].index]));
     return;
 }
 void nasal_bytecode_vm::opr_pushone()
 {
-    int val_addr=vm.gc_alloc(vm_number);
-    vm.gc_get(val_addr).set_number(1);
-    value_stack.push(val_addr);
+    value_stack.push_back(nasal_ref(1.0));
     return;
 }
 void nasal_bytecode_vm::opr_pushzero()
 {
-    int val_addr=vm.gc_alloc(vm_number);
-    vm.gc_get(val_addr).set_number(0);
-    value_stack.push(val_addr);
+    value_stack.push_back(nasal_ref(0.0));
     return;
 }
 void nasal_bytecode_vm::opr_pushnil()
 {
-    int val_addr=vm.gc_alloc(vm_nil);
-    value_stack.push(val_addr);
+    value_stack.push_back(nasal_ref());
     return;
 }
 void nasal_bytecode_vm::opr_pushstr()
 {
-    int val_addr=vm.gc_alloc(vm_string);
-    vm.gc_get(val_addr).set_string(string_table[exec_code[ptr].index]);
-    value_stack.push(val_addr);
+    value_stack.push_back(nasal_ref(vm_string,string_addr[exec_code[ptr].index]));
     return;
 }
 void nasal_bytecode_vm::opr_newvec()
 {
     int val_addr=vm.gc_alloc(vm_vector);
-    value_stack.push(val_addr);
+    vm.gc_get(val_addr).get_vector().set_packed();
+    value_stack.push_back(nasal_ref(vm_vector,val_addr));
     return;
 }
 void nasal_bytecode_vm::opr_newhash()
 {
     int val_addr=vm.gc_alloc(vm_hash);
-    value_stack.push(val_addr);
+    value_stack.push_back(nasal_ref(vm_hash,val_addr));
     return;
 }
 void nasal_bytecode_vm::opr_newfunc()
 {
     int val_addr=vm.gc_alloc(vm_function);
-    if(local_scope_stack.top()>=0)
-        vm.gc_get(val_addr).get_func().set_closure_addr(local_scope_stack.top());
-    else
+    nasal_function& ref=vm.gc_get(val_addr).get_func();
+    ref.set_local_table(&symbol_table[exec_code[ptr].index]);
+    nasal_hashmap& names=capture_table[exec_code[ptr].index];
+    if(names.size())
     {
-        int tmp_closure=vm.gc_alloc(vm_closure);
-        vm.gc_get(val_addr).get_func().set_closure_addr(tmp_closure);
-        vm.del_reference(tmp_closure);
+        // captured values are found in the running frame first,then in closure of the running function
+        nasal_call_frame& frame=call_frame.back();
+        int closure_addr=vm.gc_alloc(vm_closure);
+        nasal_closure& closure=vm.gc_get(closure_addr).get_closure();
+        closure.del_scope();
+        closure.add_scope(&names);
+        for(int i=0;i<(int)names.size();++i)
+        {
+            int index=frame.table->find(names.keys[i],names.hashes[i]);
+            int value_addr=index>=0? frame_stack[frame.base+index]:-1;
+            if(value_addr<0 && frame.closure>=0)
+                value_addr=vm.gc_get(frame.closure).get_closure().get_value_address(names.keys[i]);
+            closure.set_local(i,value_addr);
+        }
+        ref.bind_closure_addr(closure_addr);
     }
-    value_stack.push(val_addr);
+    value_stack.push_back(nasal_ref(vm_function,val_addr));
     return;
 }
 void nasal_bytecode_vm::opr_vecapp()
 {
-    int val_addr=value_stack.top();
-    value_stack.pop();
-    vm.gc_get(value_stack.top()).get_vector().add_elem(val_addr);
+    nasal_ref val=value_stack.back();
+    value_stack.pop_back();
+    vm.gc_write_barrier(value_stack.back().value.addr);
+    nasal_vector& ref=vm.gc_get(value_stack.back().value.addr).get_vector();
+    if(val.type==vm_number)
+        ref.add_number(val.value.num);
+    else
+        ref.add_elem(ref_to_gc(val));
     return;
 }
 void nasal_bytecode_vm::opr_hashapp()
 {
-    int val_addr=value_stack.top();
-    value_stack.pop();
-    int hash_addr=value_stack.top();
-    vm.gc_get(hash_addr).get_hash().add_elem(string_table[exec_code[ptr].index],val_addr);
+    int val_addr=ref_to_gc(value_stack.back());
+    value_stack.pop_back();
+    vm.gc_write_barrier(value_stack.back().value.addr);
+    vm.gc_get(value_stack.back().value.addr).get_hash().add_elem(string_table[exec_code[ptr].index],string_hash[exec_code[ptr].index],val_addr);
     return;
 }
 void nasal_bytecode_vm::opr_para()
 {
     std::string str=string_table[exec_code[ptr].index];
-    vm.gc_get(value_stack.top()).get_func().add_para(str);
+    vm.gc_get(value_stack.back().value.addr).get_func().add_para(str);
     return;
 }
 void nasal_bytecode_vm::opr_defpara()
 {
-    int val_addr=value_stack.top();
-    value_stack.pop();
+    int val_addr=ref_to_gc(value_stack.back());
+    value_stack.pop_back();
     std::string str=string_table[exec_code[ptr].index];
-    vm.gc_get(value_stack.top()).get_func().add_para(str,val_addr);
+    vm.gc_write_barrier(value_stack.back().value.addr);
+    vm.gc_get(value_stack.back().value.addr).get_func().add_para(str,val_addr);
     return;
 }
 void nasal_bytecode_vm::opr_dynpara()
 {
     std::string str=string_table[exec_code[ptr].index];
-    vm.gc_get(value_stack.top()).get_func().add_para(str,-1,true);
+    vm.gc_get(value_stack.back().value.addr).get_func().add_para(str,-1,true);
     return;
 }
 void nasal_bytecode_vm::opr_entry()
 {
-    vm.gc_get(value_stack.top()).get_func().set_entry(exec_code[ptr].index);
+    vm.gc_get(value_stack.back().value.addr).get_func().set_entry(exec_code[ptr].index);
     return;
 }
 void nasal_bytecode_vm::opr_unot()
 {
-    int val_addr=value_stack.top();
-    value_stack.pop();
-    nasal_scalar& ref=vm.gc_get(val_addr);
-    int type=ref.get_type();
-    int new_value_address=-1;
+    nasal_ref val=value_stack.back();
+    value_stack.pop_back();
+    int type=val.type;
+    nasal_ref new_value;
     if(type==vm_nil)
-    {
-        new_value_address=vm.gc_alloc(vm_number);
-        vm.gc_get(new_value_address).set_number(1);
-    }
+        new_value=nasal_ref(1.0);
     else if(type==vm_number)
-    {
-        double number=(ref.get_number()==0);
-        new_value_address=vm.gc_alloc(vm_number);
-        vm.gc_get(new_value_address).set_number(number);
-    }
+        new_value=nasal_ref((double)(val.value.num==0));
     else if(type==vm_string)
     {
-        double number=trans_string_to_number(ref.get_string());
+        const std::string& str=vm.gc_get(val.value.addr).get_string();
+        double number=trans_string_to_number(str);
         if(std::isnan(number))
-        {
-            new_value_address=vm.gc_alloc(vm_number);
-            vm.gc_get(new_value_address).set_number(!(ref.get_string()).length());
-        }
+            new_value=nasal_ref((double)(!str.length()));
         else
-        {
-            new_value_address=vm.gc_alloc(vm_number);
-            vm.gc_get(new_value_address).set_number((double)(number==0));
-        }
+            new_value=nasal_ref((double)(number==0));
     }
     else
         die("unot: incorrect value type");
-    value_stack.push(new_value_address);
-    vm.del_reference(val_addr);
+    value_stack.push_back(new_value);
     return;
 }
 void nasal_bytecode_vm::opr_usub()
 {
-    int val_addr=value_stack.top();
-    value_stack.pop();
-    nasal_scalar& ref=vm.gc_get(val_addr);
-    int type=ref.get_type();
-    double num=(1/0.0)+(-1/0.0);
-    if(type==vm_number)
-        num=ref.get_number();
-    else if(type==vm_string)
-        num=trans_string_to_number(ref.get_string());
-    int new_value_address=vm.gc_alloc(vm_number);
-    vm.gc_get(new_value_address).set_number(-num);
-    value_stack.push(new_value_address);
-    vm.del_reference(val_addr);
+    nasal_ref val=value_stack.back();
+    value_stack.pop_back();
+    value_stack.push_back(nasal_ref(-ref_to_number(val)));
     return;
 }
 void nasal_bytecode_vm::opr_add()
 {
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=value_stack.top();
-    value_stack.pop();
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    double a_num=(1/0.0)+(-1/0.0);
-    double b_num=(1/0.0)+(-1/0.0);
-    if(a_ref_type==vm_number)
-        a_num=a_ref.get_number();
-    else if(a_ref_type==vm_string)
-        a_num=trans_string_to_number(a_ref.get_string());
-    if(b_ref_type==vm_number)
-        b_num=b_ref.get_number();
-    else if(b_ref_type==vm_string)
-        b_num=trans_string_to_number(b_ref.get_string());
-
-    int new_value_address=vm.gc_alloc(vm_number);
-    vm.gc_get(new_value_address).set_number(a_num+b_num);
-    value_stack.push(new_value_address);
-    vm.del_reference(val_addr1);
-    vm.del_reference(val_addr2);
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=value_stack.back();
+    value_stack.pop_back();
+    value_stack.push_back(nasal_ref(ref_to_number(val1)+ref_to_number(val2)));
     return;
 }
 void nasal_bytecode_vm::opr_sub()
 {
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=value_stack.top();
-    value_stack.pop();
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    double a_num=(1/0.0)+(-1/0.0);
-    double b_num=(1/0.0)+(-1/0.0);
-    if(a_ref_type==vm_number)
-        a_num=a_ref.get_number();
-    else if(a_ref_type==vm_string)
-        a_num=trans_string_to_number(a_ref.get_string());
-    if(b_ref_type==vm_number)
-        b_num=b_ref.get_number();
-    else if(b_ref_type==vm_string)
-        b_num=trans_string_to_number(b_ref.get_string());
-
-    int new_value_address=vm.gc_alloc(vm_number);
-    vm.gc_get(new_value_address).set_number(a_num-b_num);
-    value_stack.push(new_value_address);
-    vm.del_reference(val_addr1);
-    vm.del_reference(val_addr2);
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=value_stack.back();
+    value_stack.pop_back();
+    value_stack.push_back(nasal_ref(ref_to_number(val1)-ref_to_number(val2)));
     return;
 }
 void nasal_bytecode_vm::opr_mul()
 {
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=value_stack.top();
-    value_stack.pop();
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    double a_num=(1/0.0)+(-1/0.0);
-    double b_num=(1/0.0)+(-1/0.0);
-    if(a_ref_type==vm_number)
-        a_num=a_ref.get_number();
-    else if(a_ref_type==vm_string)
-        a_num=trans_string_to_number(a_ref.get_string());
-    if(b_ref_type==vm_number)
-        b_num=b_ref.get_number();
-    else if(b_ref_type==vm_string)
-        b_num=trans_string_to_number(b_ref.get_string());
-
-    int new_value_address=vm.gc_alloc(vm_number);
-    vm.gc_get(new_value_address).set_number(a_num*b_num);
-    value_stack.push(new_value_address);
-    vm.del_reference(val_addr1);
-    vm.del_reference(val_addr2);
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=value_stack.back();
+    value_stack.pop_back();
+    value_stack.push_back(nasal_ref(ref_to_number(val1)*ref_to_number(val2)));
     return;
 }
 void nasal_bytecode_vm::opr_div()
 {
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=value_stack.top();
-    value_stack.pop();
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    double a_num=(1/0.0)+(-1/0.0);
-    double b_num=(1/0.0)+(-1/0.0);
-    if(a_ref_type==vm_number)
-        a_num=a_ref.get_number();
-    else if(a_ref_type==vm_string)
-        a_num=trans_string_to_number(a_ref.get_string());
-    if(b_ref_type==vm_number)
-        b_num=b_ref.get_number();
-    else if(b_ref_type==vm_string)
-        b_num=trans_string_to_number(b_ref.get_string());
-
-    int new_value_address=vm.gc_alloc(vm_number);
-    vm.gc_get(new_value_address).set_number(a_num/b_num);
-    value_stack.push(new_value_address);
-    vm.del_reference(val_addr1);
-    vm.del_reference(val_addr2);
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=value_stack.back();
+    value_stack.pop_back();
+    value_stack.push_back(nasal_ref(ref_to_number(val1)/ref_to_number(val2)));
     return;
 }
 void nasal_bytecode_vm::opr_lnk()
 {
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=value_stack.top();
-    value_stack.pop();
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    if((a_ref_type!=vm_number && a_ref_type!=vm_string)||(b_ref_type!=vm_number && b_ref_type!=vm_string))
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=value_stack.back();
+    value_stack.pop_back();
+    if((val1.type!=vm_number && val1.type!=vm_string)||(val2.type!=vm_number && val2.type!=vm_string))
     {
         die("lnk: error value type");
         return;
     }
-    std::string a_str=(a_ref_type==vm_number)? trans_number_to_string(a_ref.get_number()):a_ref.get_string();
-    std::string b_str=(b_ref_type==vm_number)? trans_number_to_string(b_ref.get_number()):b_ref.get_string();
-    int new_value_address=vm.gc_alloc(vm_string);
-    vm.gc_get(new_value_address).set_string(a_str+b_str);
-    value_stack.push(new_value_address);
-    vm.del_reference(val_addr1);
-    vm.del_reference(val_addr2);
+    int new_value_address;
+    if(val1.type==vm_string)
+    {
+        if(val2.type==vm_number)
+            new_value_address=vm.gc_link(val1.value.addr,trans_number_to_string(val2.value.num));
+        else
+            new_value_address=vm.gc_link(val1.value.addr,vm.gc_get(val2.value.addr).get_string());
+    }
+    else
+    {
+        std::string str=trans_number_to_string(val1.value.num);
+        if(val2.type==vm_number)
+            str+=trans_number_to_string(val2.value.num);
+        else
+            str+=vm.gc_get(val2.value.addr).get_string();
+        new_value_address=vm.gc_alloc(vm_string);
+        vm.gc_get(new_value_address).set_string(str);
+    }
+    value_stack.push_back(nasal_ref(vm_string,new_value_address));
     return;
 }
 void nasal_bytecode_vm::opr_addeq()
 {
-    int mem_addr=value_stack.top();
-    value_stack.pop();
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=vm.mem_get(mem_addr);
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    double a_num=(1/0.0)+(-1/0.0);
-    double b_num=(1/0.0)+(-1/0.0);
-    if(a_ref_type==vm_number)
-        a_num=a_ref.get_number();
-    else if(a_ref_type==vm_string)
-        a_num=trans_string_to_number(a_ref.get_string());
-    if(b_ref_type==vm_number)
-        b_num=b_ref.get_number();
-    else if(b_ref_type==vm_string)
-        b_num=trans_string_to_number(b_ref.get_string());
-
-    int new_value_address=vm.gc_alloc(vm_number);
-    vm.gc_get(new_value_address).set_number(a_num+b_num);
-    vm.add_reference(new_value_address);
-    value_stack.push(new_value_address);
-    vm.mem_change(mem_addr,new_value_address);
-    vm.del_reference(val_addr2);
+    nasal_mem_slot mem_addr=mem_stack.top();
+    mem_stack.pop();
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=mem_load(mem_addr);
+    nasal_ref new_value(ref_to_number(val1)+ref_to_number(val2));
+    value_stack.push_back(new_value);
+    mem_store(mem_addr,new_value);
     return;
 }
 void nasal_bytecode_vm::opr_subeq()
 {
-    int mem_addr=value_stack.top();
-    value_stack.pop();
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=vm.mem_get(mem_addr);
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    double a_num=(1/0.0)+(-1/0.0);
-    double b_num=(1/0.0)+(-1/0.0);
-    if(a_ref_type==vm_number)
-        a_num=a_ref.get_number();
-    else if(a_ref_type==vm_string)
-        a_num=trans_string_to_number(a_ref.get_string());
-    if(b_ref_type==vm_number)
-        b_num=b_ref.get_number();
-    else if(b_ref_type==vm_string)
-        b_num=trans_string_to_number(b_ref.get_string());
-
-    int new_value_address=vm.gc_alloc(vm_number);
-    vm.gc_get(new_value_address).set_number(a_num-b_num);
-    vm.add_reference(new_value_address);
-    value_stack.push(new_value_address);
-    vm.mem_change(mem_addr,new_value_address);
-    vm.del_reference(val_addr2);
+    nasal_mem_slot mem_addr=mem_stack.top();
+    mem_stack.pop();
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=mem_load(mem_addr);
+    nasal_ref new_value(ref_to_number(val1)-ref_to_number(val2));
+    value_stack.push_back(new_value);
+    mem_store(mem_addr,new_value);
     return;
 }
 void nasal_bytecode_vm::opr_muleq()
 {
-    int mem_addr=value_stack.top();
-    value_stack.pop();
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=vm.mem_get(mem_addr);
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    double a_num=(1/0.0)+(-1/0.0);
-    double b_num=(1/0.0)+(-1/0.0);
-    if(a_ref_type==vm_number)
-        a_num=a_ref.get_number();
-    else if(a_ref_type==vm_string)
-        a_num=trans_string_to_number(a_ref.get_string());
-    if(b_ref_type==vm_number)
-        b_num=b_ref.get_number();
-    else if(b_ref_type==vm_string)
-        b_num=trans_string_to_number(b_ref.get_string());
-
-    int new_value_address=vm.gc_alloc(vm_number);
-    vm.gc_get(new_value_address).set_number(a_num*b_num);
-    vm.add_reference(new_value_address);
-    value_stack.push(new_value_address);
-    vm.mem_change(mem_addr,new_value_address);
-    vm.del_reference(val_addr2);
+    nasal_mem_slot mem_addr=mem_stack.top();
+    mem_stack.pop();
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=mem_load(mem_addr);
+    nasal_ref new_value(ref_to_number(val1)*ref_to_number(val2));
+    value_stack.push_back(new_value);
+    mem_store(mem_addr,new_value);
     return;
 }
 void nasal_bytecode_vm::opr_diveq()
 {
-    int mem_addr=value_stack.top();
-    value_stack.pop();
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=vm.mem_get(mem_addr);
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    double a_num=(1/0.0)+(-1/0.0);
-    double b_num=(1/0.0)+(-1/0.0);
-    if(a_ref_type==vm_number)
-        a_num=a_ref.get_number();
-    else if(a_ref_type==vm_string)
-        a_num=trans_string_to_number(a_ref.get_string());
-    if(b_ref_type==vm_number)
-        b_num=b_ref.get_number();
-    else if(b_ref_type==vm_string)
-        b_num=trans_string_to_number(b_ref.get_string());
-
-    int new_value_address=vm.gc_alloc(vm_number);
-    vm.gc_get(new_value_address).set_number(a_num/b_num);
-    vm.add_reference(new_value_address);
-    value_stack.push(new_value_address);
-    vm.mem_change(mem_addr,new_value_address);
-    vm.del_reference(val_addr2);
+    nasal_mem_slot mem_addr=mem_stack.top();
+    mem_stack.pop();
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=mem_load(mem_addr);
+    nasal_ref new_value(ref_to_number(val1)/ref_to_number(val2));
+    value_stack.push_back(new_value);
+    mem_store(mem_addr,new_value);
     return;
 }
 void nasal_bytecode_vm::opr_lnkeq()
 {
-    int mem_addr=value_stack.top();
-    value_stack.pop();
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=vm.mem_get(mem_addr);
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    if((a_ref_type!=vm_number && a_ref_type!=vm_string)||(b_ref_type!=vm_number && b_ref_type!=vm_string))
+    nasal_mem_slot mem_addr=mem_stack.top();
+    mem_stack.pop();
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=mem_load(mem_addr);
+    if((val1.type!=vm_number && val1.type!=vm_string)||(val2.type!=vm_number && val2.type!=vm_string))
     {
         die("lnkeq: error value type");
         return;
     }
-    std::string a_str=(a_ref_type==vm_number)? trans_number_to_string(a_ref.get_number()):a_ref.get_string();
-    std::string b_str=(b_ref_type==vm_number)? trans_number_to_string(b_ref.get_number()):b_ref.get_string();
-    int new_value_address=vm.gc_alloc(vm_string);
-    vm.gc_get(new_value_address).set_string(a_str+b_str);
-    vm.add_reference(new_value_address);
-    value_stack.push(new_value_address);
-    vm.mem_change(mem_addr,new_value_address);
-    vm.del_reference(val_addr2);
+    int new_value_address;
+    if(val1.type==vm_string)
+    {
+        if(val2.type==vm_number)
+            new_value_address=vm.gc_link(val1.value.addr,trans_number_to_string(val2.value.num));
+        else
+            new_value_address=vm.gc_link(val1.value.addr,vm.gc_get(val2.value.addr).get_string());
+    }
+    else
+    {
+        std::string str=trans_number_to_string(val1.value.num);
+        if(val2.type==vm_number)
+            str+=trans_number_to_string(val2.value.num);
+        else
+            str+=vm.gc_get(val2.value.addr).get_string();
+        new_value_address=vm.gc_alloc(vm_string);
+        vm.gc_get(new_value_address).set_string(str);
+    }
+    nasal_ref new_value(vm_string,new_value_address);
+    value_stack.push_back(new_value);
+    mem_store(mem_addr,new_value);
     return;
 }
 void nasal_bytecode_vm::opr_meq()
 {
-    int mem_addr=value_stack.top();
-    value_stack.pop();
-    int val_addr=value_stack.top();
-    vm.add_reference(val_addr);
-    vm.mem_change(mem_addr,val_addr);
+    nasal_mem_slot mem_addr=mem_stack.top();
+    mem_stack.pop();
+    mem_store(mem_addr,value_stack.back());
     return;
 }
 void nasal_bytecode_vm::opr_eq()
 {
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=value_stack.top();
-    value_stack.pop();
-    if(val_addr1==val_addr2)
-    {
-        int new_value_address=vm.gc_alloc(vm_number);
-        vm.gc_get(new_value_address).set_number(1);
-        value_stack.push(new_value_address);
-        vm.del_reference(val_addr1);
-        vm.del_reference(val_addr2);
-        return;
-    }
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    if(a_ref_type==vm_nil && b_ref_type==vm_nil)
-    {
-        int new_value_address=vm.gc_alloc(vm_number);
-        vm.gc_get(new_value_address).set_number(1);
-        value_stack.push(new_value_address);
-        vm.del_reference(val_addr1);
-        vm.del_reference(val_addr2);
-        return;
-    }
-    else if((a_ref_type==vm_number || a_ref_type==vm_string) && (b_ref_type==vm_number || b_ref_type==vm_string))
-    {
-        if(a_ref_type==vm_string && b_ref_type==vm_string)
-        {
-            std::string astr=a_ref.get_string();
-            std::string bstr=b_ref.get_string();
-            int new_value_address=vm.gc_alloc(vm_number);
-            vm.gc_get(new_value_address).set_number((double)(astr==bstr));
-            value_stack.push(new_value_address);
-            vm.del_reference(val_addr1);
-            vm.del_reference(val_addr2);
-            return;
-        }
-        double a_num;
-        double b_num;
-        if(a_ref_type==vm_number)
-            a_num=a_ref.get_number();
-        else
-            a_num=trans_string_to_number(a_ref.get_string());
-        if(b_ref_type==vm_number)
-            b_num=b_ref.get_number();
-        else
-            b_num=trans_string_to_number(b_ref.get_string());
-        
-        int new_value_address=vm.gc_alloc(vm_number);
-        vm.gc_get(new_value_address).set_number((double)(a_num==b_num));
-        value_stack.push(new_value_address);
-        vm.del_reference(val_addr1);
-        vm.del_reference(val_addr2);
-        return;
-    }
-    else
-    {
-        int new_value_address=vm.gc_alloc(vm_number);
-        vm.gc_get(new_value_address).set_number(0);
-        value_stack.push(new_value_address);
-        vm.del_reference(val_addr1);
-        vm.del_reference(val_addr2);
-        return;
-    }
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=value_stack.back();
+    value_stack.pop_back();
+    value_stack.push_back(nasal_ref((double)ref_equal(val1,val2)));
     return;
 }
 void nasal_bytecode_vm::opr_neq()
 {
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=value_stack.top();
-    value_stack.pop();
-    if(val_addr1==val_addr2)
-    {
-        int new_value_address=vm.gc_alloc(vm_number);
-        vm.gc_get(new_value_address).set_number(0);
-        value_stack.push(new_value_address);
-        vm.del_reference(val_addr1);
-        vm.del_reference(val_addr2);
-        return;
-    }
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    if(a_ref_type==vm_nil && b_ref_type==vm_nil)
-    {
-        int new_value_address=vm.gc_alloc(vm_number);
-        vm.gc_get(new_value_address).set_number(0);
-        value_stack.push(new_value_address);
-        vm.del_reference(val_addr1);
-        vm.del_reference(val_addr2);
-        return;
-    }
-    else if((a_ref_type==vm_number || a_ref_type==vm_string) && (b_ref_type==vm_number || b_ref_type==vm_string))
-    {
-        if(a_ref_type==vm_string && b_ref_type==vm_string)
-        {
-            std::string astr=a_ref.get_string();
-            std::string bstr=b_ref.get_string();
-            int new_value_address=vm.gc_alloc(vm_number);
-            vm.gc_get(new_value_address).set_number((double)(astr!=bstr));
-            value_stack.push(new_value_address);
-            vm.del_reference(val_addr1);
-            vm.del_reference(val_addr2);
-            return;
-        }
-        double a_num;
-        double b_num;
-        if(a_ref_type==vm_number)
-            a_num=a_ref.get_number();
-        else
-            a_num=trans_string_to_number(a_ref.get_string());
-        if(b_ref_type==vm_number)
-            b_num=b_ref.get_number();
-        else
-            b_num=trans_string_to_number(b_ref.get_string());
-        
-        int new_value_address=vm.gc_alloc(vm_number);
-        vm.gc_get(new_value_address).set_number((double)(a_num!=b_num));
-        value_stack.push(new_value_address);
-        vm.del_reference(val_addr1);
-        vm.del_reference(val_addr2);
-        return;
-    }
-    else
-    {
-        int new_value_address=vm.gc_alloc(vm_number);
-        vm.gc_get(new_value_address).set_number(1);
-        value_stack.push(new_value_address);
-        vm.del_reference(val_addr1);
-        vm.del_reference(val_addr2);
-        return;
-    }
-    vm.del_reference(val_addr1);
-    vm.del_reference(val_addr2);
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=value_stack.back();
+    value_stack.pop_back();
+    value_stack.push_back(nasal_ref((double)!ref_equal(val1,val2)));
     return;
 }
 void nasal_bytecode_vm::opr_less()
 {
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=value_stack.top();
-    value_stack.pop();
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    if(a_ref_type==vm_string && b_ref_type==vm_string)
-    {
-        std::string a_str=a_ref.get_string();
-        std::string b_str=b_ref.get_string();
-        int new_value_address=vm.gc_alloc(vm_number);
-        vm.gc_get(new_value_address).set_number((double)(a_str<b_str));
-        value_stack.push(new_value_address);
-        vm.del_reference(val_addr1);
-        vm.del_reference(val_addr2);
-        return;
-    }
-    double a_num=(1/0.0)+(-1/0.0);
-    double b_num=(1/0.0)+(-1/0.0);
-    if(a_ref_type==vm_number)
-        a_num=a_ref.get_number();
-    else if(a_ref_type==vm_string)
-        a_num=trans_string_to_number(a_ref.get_string());
-    if(b_ref_type==vm_number)
-        b_num=b_ref.get_number();
-    else if(b_ref_type==vm_string)
-        b_num=trans_string_to_number(b_ref.get_string());
-
-    int new_value_address=vm.gc_alloc(vm_number);
-    vm.gc_get(new_value_address).set_number((double)(a_num<b_num));
-    value_stack.push(new_value_address);
-    vm.del_reference(val_addr1);
-    vm.del_reference(val_addr2);
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=value_stack.back();
+    value_stack.pop_back();
+    if(val1.type==vm_string && val2.type==vm_string)
+        value_stack.push_back(nasal_ref((double)(vm.gc_get(val1.value.addr).get_string()<vm.gc_get(val2.value.addr).get_string())));
+    else
+        value_stack.push_back(nasal_ref((double)(ref_to_number(val1)<ref_to_number(val2))));
     return;
 }
 void nasal_bytecode_vm::opr_leq()
 {
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=value_stack.top();
-    value_stack.pop();
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    if(a_ref_type==vm_string && b_ref_type==vm_string)
-    {
-        std::string a_str=a_ref.get_string();
-        std::string b_str=b_ref.get_string();
-        int new_value_address=vm.gc_alloc(vm_number);
-        vm.gc_get(new_value_address).set_number((double)(a_str<=b_str));
-        value_stack.push(new_value_address);
-        vm.del_reference(val_addr1);
-        vm.del_reference(val_addr2);
-        return;
-    }
-    double a_num=(1/0.0)+(-1/0.0);
-    double b_num=(1/0.0)+(-1/0.0);
-    if(a_ref_type==vm_number)
-        a_num=a_ref.get_number();
-    else if(a_ref_type==vm_string)
-        a_num=trans_string_to_number(a_ref.get_string());
-    if(b_ref_type==vm_number)
-        b_num=b_ref.get_number();
-    else if(b_ref_type==vm_string)
-        b_num=trans_string_to_number(b_ref.get_string());
-
-    int new_value_address=vm.gc_alloc(vm_number);
-    vm.gc_get(new_value_address).set_number((double)(a_num<=b_num));
-    value_stack.push(new_value_address);
-    vm.del_reference(val_addr1);
-    vm.del_reference(val_addr2);
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=value_stack.back();
+    value_stack.pop_back();
+    if(val1.type==vm_string && val2.type==vm_string)
+        value_stack.push_back(nasal_ref((double)(vm.gc_get(val1.value.addr).get_string()<=vm.gc_get(val2.value.addr).get_string())));
+    else
+        value_stack.push_back(nasal_ref((double)(ref_to_number(val1)<=ref_to_number(val2))));
     return;
 }
 void nasal_bytecode_vm::opr_grt()
 {
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=value_stack.top();
-    value_stack.pop();
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    if(a_ref_type==vm_string && b_ref_type==vm_string)
-    {
-        std::string a_str=a_ref.get_string();
-        std::string b_str=b_ref.get_string();
-        int new_value_address=vm.gc_alloc(vm_number);
-        vm.gc_get(new_value_address).set_number((double)(a_str>b_str));
-        value_stack.push(new_value_address);
-        vm.del_reference(val_addr1);
-        vm.del_reference(val_addr2);
-        return;
-    }
-    double a_num=(1/0.0)+(-1/0.0);
-    double b_num=(1/0.0)+(-1/0.0);
-    if(a_ref_type==vm_number)
-        a_num=a_ref.get_number();
-    else if(a_ref_type==vm_string)
-        a_num=trans_string_to_number(a_ref.get_string());
-    if(b_ref_type==vm_number)
-        b_num=b_ref.get_number();
-    else if(b_ref_type==vm_string)
-        b_num=trans_string_to_number(b_ref.get_string());
-
-    int new_value_address=vm.gc_alloc(vm_number);
-    vm.gc_get(new_value_address).set_number((double)(a_num>b_num));
-    value_stack.push(new_value_address);
-    vm.del_reference(val_addr1);
-    vm.del_reference(val_addr2);
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=value_stack.back();
+    value_stack.pop_back();
+    if(val1.type==vm_string && val2.type==vm_string)
+        value_stack.push_back(nasal_ref((double)(vm.gc_get(val1.value.addr).get_string()>vm.gc_get(val2.value.addr).get_string())));
+    else
+        value_stack.push_back(nasal_ref((double)(ref_to_number(val1)>ref_to_number(val2))));
     return;
 }
 void nasal_bytecode_vm::opr_geq()
 {
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=value_stack.top();
-    value_stack.pop();
-    nasal_scalar& a_ref=vm.gc_get(val_addr1);
-    nasal_scalar& b_ref=vm.gc_get(val_addr2);
-    int a_ref_type=a_ref.get_type();
-    int b_ref_type=b_ref.get_type();
-    if(a_ref_type==vm_string && b_ref_type==vm_string)
-    {
-        std::string a_str=a_ref.get_string();
-        std::string b_str=b_ref.get_string();
-        int new_value_address=vm.gc_alloc(vm_number);
-        vm.gc_get(new_value_address).set_number((double)(a_str>=b_str));
-        value_stack.push(new_value_address);
-        vm.del_reference(val_addr1);
-        vm.del_reference(val_addr2);
-        return;
-    }
-    double a_num=(1/0.0)+(-1/0.0);
-    double b_num=(1/0.0)+(-1/0.0);
-    if(a_ref_type==vm_number)
-        a_num=a_ref.get_number();
-    else if(a_ref_type==vm_string)
-        a_num=trans_string_to_number(a_ref.get_string());
-    if(b_ref_type==vm_number)
-        b_num=b_ref.get_number();
-    else if(b_ref_type==vm_string)
-        b_num=trans_string_to_number(b_ref.get_string());
-
-    int new_value_address=vm.gc_alloc(vm_number);
-    vm.gc_get(new_value_address).set_number((double)(a_num>=b_num));
-    value_stack.push(new_value_address);
-    vm.del_reference(val_addr1);
-    vm.del_reference(val_addr2);
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=value_stack.back();
+    value_stack.pop_back();
+    if(val1.type==vm_string && val2.type==vm_string)
+        value_stack.push_back(nasal_ref((double)(vm.gc_get(val1.value.addr).get_string()>=vm.gc_get(val2.value.addr).get_string())));
+    else
+        value_stack.push_back(nasal_ref((double)(ref_to_number(val1)>=ref_to_number(val2))));
     return;
 }
 void nasal_bytecode_vm::opr_pop()
 {
-    int val_addr=value_stack.top();
-    value_stack.pop();
-    vm.del_reference(val_addr);
+    value_stack.pop_back();
     return;
 }
 void nasal_bytecode_vm::opr_jmp()
@@ -995,19 +1185,19 @@ void nasal_bytecode_vm::opr_jmp()
 }
 void nasal_bytecode_vm::opr_jmptrue()
 {
-    if(check_condition(value_stack.top()))
+    if(check_condition(value_stack.back()))
         ptr=exec_code[ptr].index-1;
     return;
 }
 void nasal_bytecode_vm::opr_jmpfalse()
 {
-    if(!check_condition(value_stack.top()))
+    if(!check_condition(value_stack.back()))
         ptr=exec_code[ptr].index-1;
     return;
 }
 void nasal_bytecode_vm::opr_counter()
 {
-    if(vm.gc_get(value_stack.top()).get_type()!=vm_vector)
+    if(value_stack.back().type!=vm_vector)
     {
         die("cnt: must use vector in forindex/foreach");
         return;
@@ -1017,88 +1207,106 @@ void nasal_bytecode_vm::opr_counter()
 }
 void nasal_bytecode_vm::opr_forindex()
 {
-    nasal_vector& ref=vm.gc_get(value_stack.top()).get_vector();
+    nasal_vector& ref=vm.gc_get(value_stack.back().value.addr).get_vector();
     counter_stack.top()++;
     if(counter_stack.top()>=ref.size())
     {
-        vm.del_reference(value_stack.top());
-        value_stack.pop();
+        value_stack.pop_back();
         counter_stack.pop();
         ptr=exec_code[ptr].index-1;
         return;
     }
-    int res=vm.gc_alloc(vm_number);
-    vm.gc_get(res).set_number((double)counter_stack.top());
-    value_stack.push(res);
+    value_stack.push_back(nasal_ref((double)counter_stack.top()));
     return;
 }
 void nasal_bytecode_vm::opr_foreach()
 {
-    nasal_vector& ref=vm.gc_get(value_stack.top()).get_vector();
+    nasal_vector& ref=vm.gc_get(value_stack.back().value.addr).get_vector();
     counter_stack.top()++;
     if(counter_stack.top()>=ref.size())
     {
-        vm.del_reference(value_stack.top());
-        value_stack.pop();
+        value_stack.pop_back();
         counter_stack.pop();
         ptr=exec_code[ptr].index-1;
         return;
     }
-    int res=ref.get_value_address(counter_stack.top());
-    vm.add_reference(res);
-    value_stack.push(res);
+    if(ref.is_packed())
+        value_stack.push_back(nasal_ref(ref.get_number(counter_stack.top())));
+    else
+        value_stack.push_back(gc_to_ref(ref.get_value_address(counter_stack.top())));
     return;
 }
 void nasal_bytecode_vm::opr_call()
 {
-    int val_addr=-1;
-    if(local_scope_stack.top()>=0)
-        val_addr=vm.gc_get(local_scope_stack.top()).get_closure().get_value_address(string_table[exec_code[ptr].index]);
-    if(val_addr<0)
-        val_addr=vm.gc_get(global_scope_addr).get_closure().get_value_address(string_table[exec_code[ptr].index]);
-    if(val_addr<0)
+    int closure_addr;
+    int* mem_addr=name_mem_address(closure_addr);
+    if(!mem_addr)
     {
         die("call: cannot find symbol named \""+string_table[exec_code[ptr].index]+"\"");
         return;
     }
-    vm.add_reference(val_addr);
-    value_stack.push(val_addr);
+    value_stack.push_back(gc_to_ref(*mem_addr));
+    return;
+}
+void nasal_bytecode_vm::opr_callg()
+{
+    nasal_closure& ref=vm.gc_get(global_scope_addr).get_closure();
+    int val_addr=ref.get_local(exec_code[ptr].index);
+    if(val_addr<0)
+    {
+        die("call: cannot find symbol named \""+ref.get_local_name(exec_code[ptr].index)+"\"");
+        return;
+    }
+    value_stack.push_back(gc_to_ref(val_addr));
+    return;
+}
+void nasal_bytecode_vm::opr_calll()
+{
+    int val_addr=local_value_address(exec_code[ptr].index);
+    if(val_addr<0)
+        return;
+    value_stack.push_back(gc_to_ref(val_addr));
     return;
 }
 void nasal_bytecode_vm::opr_callv()
 {
-    int val_addr=value_stack.top();
-    value_stack.pop();
-    int vec_addr=value_stack.top();
-    value_stack.pop();
-    int type=vm.gc_get(vec_addr).get_type();
+    nasal_ref val=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref vec=value_stack.back();
+    value_stack.pop_back();
+    int type=vec.type;
     if(type==vm_vector)
     {
         int num;
-        switch(vm.gc_get(val_addr).get_type())
+        switch(val.type)
         {
-            case vm_number:num=(int)vm.gc_get(val_addr).get_number();break;
-            case vm_string:num=(int)trans_string_to_number(vm.gc_get(val_addr).get_string());break;
-            default:die("callv: error value type");break;
+            case vm_number:
+            case vm_string:num=(int)ref_to_number(val);break;
+            default:die("callv: error value type");return;
+        }
+        nasal_vector& ref=vm.gc_get(vec.value.addr).get_vector();
+        if(ref.is_packed() && ref.check_index(num))
+        {
+            value_stack.push_back(nasal_ref(ref.get_number(num)));
+            return;
         }
-        int res=vm.gc_get(vec_addr).get_vector().get_value_address(num);
+        int res=ref.get_value_address(num);
         if(res<0)
         {
             die("callv: index out of range");
             return;
         }
-        vm.add_reference(res);
-        value_stack.push(res);
+        value_stack.push_back(gc_to_ref(res));
     }
     else if(type==vm_string)
     {
-        std::string str=vm.gc_get(vec_addr).get_string();
+        const std::string& str=vm.gc_get(vec.value.addr).get_string();
         int num;
-        switch(vm.gc_get(val_addr).get_type())
+        switch(val.type)
         {
-            case vm_number:num=(int)vm.gc_get(val_addr).get_number();break;
-            case vm_string:num=(int)trans_string_to_number(vm.gc_get(val_addr).get_string());break;
-            default:die("callv: error value type");break;
+            case vm_number:
+            case vm_string:num=(int)ref_to_number(val);break;
+            default:die("callv: error value type");return;
         }
         int str_size=str.length();
         if(num<-str_size || num>=str_size)
@@ -1106,95 +1314,94 @@ void nasal_bytecode_vm::opr_callv()
             die("callv: index out of range");
             return;
         }
-        int res=vm.gc_alloc(vm_number);
-        vm.gc_get(res).set_number((double)str[(num+str_size)%str_size]);
-        value_stack.push(res);
+        value_stack.push_back(nasal_ref((double)str[(num+str_size)%str_size]));
     }
     else if(type==vm_hash)
     {
-        if(vm.gc_get(val_addr).get_type()!=vm_string)
+        if(val.type!=vm_string)
         {
             die("callv: must use string as the key");
             return;
         }
-        int res=vm.gc_get(vec_addr).get_hash().get_value_address(vm.gc_get(val_addr).get_string());
+        int res=vm.gc_get(vec.value.addr).get_hash().get_value_address(vm.gc_get(val.value.addr).get_string(),vm.gc_string_hash(val.value.addr));
         if(res<0)
         {
-            die("callv: cannot find member \""+vm.gc_get(val_addr).get_string()+"\" of this hash");
+            die("callv: cannot find member \""+vm.gc_get(val.value.addr).get_string()+"\" of this hash");
             return;
         }
         if(vm.gc_get(res).get_type()==vm_function)
         {
-            vm.gc_get(vm.gc_get(res).get_func().get_closure_addr()).get_closure().add_new_value("me",val_addr);
-            vm.add_reference(val_addr);
+            set_me(res,vec.value.addr);
         }
-        vm.add_reference(res);
-        value_stack.push(res);
+        value_stack.push_back(gc_to_ref(res));
     }
-    vm.del_reference(val_addr);
-    vm.del_reference(vec_addr);
     return;
 }
 void nasal_bytecode_vm::opr_callvi()
 {
-    int val_addr=value_stack.top();
-    if(vm.gc_get(val_addr).get_type()!=vm_vector)
+    nasal_ref val=value_stack.back();
+    if(val.type!=vm_vector)
     {
         die("callvi: multi-definition/multi-assignment must use a vector");
         return;
     }
-    int res=vm.gc_get(val_addr).get_vector().get_value_address(exec_code[ptr].index);
+    nasal_vector& ref=vm.gc_get(val.value.addr).get_vector();
+    if(ref.is_packed() && ref.check_index(exec_code[ptr].index))
+    {
+        value_stack.push_back(nasal_ref(ref.get_number(exec_code[ptr].index)));
+        return;
+    }
+    int res=ref.get_value_address(exec_code[ptr].index);
     if(res<0)
     {
         die("callvi: index out of range");
         return;
     }
-    vm.add_reference(res);
-    value_stack.push(res);
+    value_stack.push_back(gc_to_ref(res));
     return;
 }
 void nasal_bytecode_vm::opr_callh()
 {
-    int val_addr=value_stack.top();
-    value_stack.pop();
-    if(vm.gc_get(val_addr).get_type()!=vm_hash)
+    nasal_ref val=value_stack.back();
+    value_stack.pop_back();
+    if(val.type!=vm_hash)
     {
         die("callh: must call a hash");
         return;
     }
-    int res=vm.gc_get(val_addr).get_hash().get_value_address(string_table[exec_code[ptr].index]);
+    int res=hash_member(vm.gc_get(val.value.addr).get_hash());
     if(res<0)
     {
         die("callh: hash member \""+string_table[exec_code[ptr].index]+"\" does not exist");
         return;
     }
-    vm.add_reference(res);
+    value_stack.push_back(gc_to_ref(res));
     if(vm.gc_get(res).get_type()==vm_function)
-        vm.gc_get(vm.gc_get(res).get_func().get_closure_addr()).get_closure().add_new_value("me",val_addr);
-    else
-        vm.del_reference(val_addr);
-    value_stack.push(res);
+    {
+        set_me(res,val.value.addr);
+    }
     return;
 }
 void nasal_bytecode_vm::opr_callf()
 {
-    int para_addr=value_stack.top();
-    value_stack.pop();
-    int func_addr=value_stack.top();
-    if(vm.gc_get(func_addr).get_type()!=vm_function)
+    nasal_ref para=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref func=value_stack.back();
+    if(func.type!=vm_function)
     {
         die("callf: called a value that is not a function");
         return;
     }
-    nasal_function& ref=vm.gc_get(func_addr).get_func();
-    int closure=ref.get_closure_addr();
-    nasal_closure& ref_closure=vm.gc_get(closure).get_closure();
-    ref_closure.add_scope();
-    local_scope_stack.push(closure);
-    vm.add_reference(closure);
-    if(vm.gc_get(para_addr).get_type()==vm_vector)
-    {
-        nasal_vector& ref_vec=vm.gc_get(para_addr).get_vector();
+    nasal_function& ref=vm.gc_get(func.value.addr).get_func();
+    // parameters are the first slots of frame,dynamic parameter is after them
+    const nasal_hashmap* table=ref.get_local_table();
+    int base=frame_stack.size();
+    frame_stack.resize(base+table->size(),-1);
+    call_frame.push_back(nasal_call_frame(ref.get_closure_addr(),base,ptr,table));
+    int* local=table->size()? &frame_stack[base]:NULL;
+    if(para.type==vm_vector)
+    {
+        nasal_vector& ref_vec=vm.gc_get(para.value.addr).get_vector();
         std::vector<std::string>& ref_para=ref.get_para();
         std::vector<int>& ref_default=ref.get_default();
         int i=0;
@@ -1207,31 +1414,23 @@ void nasal_bytecode_vm::opr_callf()
                     die("callf: lack argument(s)");
                     return;
                 }
-                ref_closure.add_new_value(ref_para[i],ref_default[i]);
-                vm.add_reference(ref_default[i]);
+                local[i]=ref_default[i];
             }
             else
-            {
-                int tmp=ref_vec.get_value_address(i);
-                ref_closure.add_new_value(ref_para[i],tmp);
-                vm.add_reference(tmp);
-            }
+                local[i]=ref_vec.get_value_address(i);
         }
         if(ref.get_dynamic_para().length())
         {
             int vec_addr=vm.gc_alloc(vm_vector);
+            nasal_vector& dyn_vec=vm.gc_get(vec_addr).get_vector();
             for(;i<ref_vec.size();++i)
-            {
-                int tmp=ref_vec.get_value_address(i);
-                vm.gc_get(vec_addr).get_vector().add_elem(tmp);
-                vm.add_reference(tmp);
-            }
-            ref_closure.add_new_value(ref.get_dynamic_para(),vec_addr);
+                dyn_vec.add_elem(ref_vec.get_value_address(i));
+            local[ref_para.size()]=vec_addr;
         }
     }
     else
     {
-        nasal_hash& ref_hash=vm.gc_get(para_addr).get_hash();
+        nasal_hash& ref_hash=vm.gc_get(para.value.addr).get_hash();
         std::vector<std::string>& ref_para=ref.get_para();
         std::vector<int>& ref_default=ref.get_default();
         if(ref.get_dynamic_para().length())
@@ -1249,91 +1448,104 @@ void nasal_bytecode_vm::opr_callf()
                 die("callf: lack argument(s)");
                 return;
             }
-            ref_closure.add_new_value(ref_para[i],tmp);
-            vm.add_reference(tmp);
+            local[i]=tmp;
         }
     }
-    vm.del_reference(para_addr);
-    call_stack.push(ptr);
     ptr=ref.get_entry()-1;
     return;
 }
 void nasal_bytecode_vm::opr_builtincall()
 {
-    int ret_value_addr=-1;
+    nasal_ref ret_value;
     std::string val_name=string_table[exec_code[ptr].index];
     if(builtin_func_hashmap.find(val_name)!=builtin_func_hashmap.end())
     {
-        ret_value_addr=(*builtin_func_hashmap[val_name])(local_scope_stack.top(),vm);
+        // builtins find arguments by name,so values of this call are lent to them as a scope
+        nasal_call_frame& frame=call_frame.back();
+        int scope_addr=frame.table? builtin_scope_addr:-1;
+        if(frame.table)
+            vm.gc_get(scope_addr).get_closure().add_scope(frame.table,frame.table->size()? &frame_stack[frame.base]:NULL);
+        int ret_value_addr=(*builtin_func_hashmap[val_name])(scope_addr,vm);
+        if(frame.table)
+            vm.gc_get(scope_addr).get_closure().del_scope();
         error+=builtin_die_state;
+        ret_value=gc_to_ref(ret_value_addr);
     }
-    value_stack.push(ret_value_addr);
+    value_stack.push_back(ret_value);
     return;
 }
 void nasal_bytecode_vm::opr_slicebegin()
 {
     int val_addr=vm.gc_alloc(vm_vector);
-    slice_stack.push(val_addr);
-    if(vm.gc_get(value_stack.top()).get_type()!=vm_vector)
+    vm.gc_get(val_addr).get_vector().set_packed();
+    slice_stack.push_back(val_addr);
+    if(value_stack.back().type!=vm_vector)
         die("slcbegin: must slice a vector");
     return;
 }
 void nasal_bytecode_vm::opr_sliceend()
 {
-    int val_addr=slice_stack.top();
-    slice_stack.pop();
-    value_stack.push(val_addr);
+    int val_addr=slice_stack.back();
+    slice_stack.pop_back();
+    value_stack.pop_back();
+    value_stack.push_back(nasal_ref(vm_vector,val_addr));
     return;
 }
 void nasal_bytecode_vm::opr_slice()
 {
-    int val_addr=value_stack.top();
-    value_stack.pop();
-    int type=vm.gc_get(val_addr).get_type();
+    nasal_ref val=value_stack.back();
+    value_stack.pop_back();
     double num;
-    switch(type)
+    switch(val.type)
+    {
+        case vm_number:
+        case vm_string:num=ref_to_number(val);break;
+        default:die("slc: error value type");return;
+    }
+    nasal_vector& ref=vm.gc_get(value_stack.back().value.addr).get_vector();
+    nasal_vector& aim=vm.gc_get(slice_stack.back()).get_vector();
+    vm.gc_write_barrier(slice_stack.back());
+    if(ref.is_packed() && ref.check_index((int)num))
     {
-        case vm_number:num=vm.gc_get(val_addr).get_number();break;
-        case vm_string:num=trans_string_to_number(vm.gc_get(val_addr).get_string());break;
-        default:die("slc: error value type");break;
+        aim.add_number(ref.get_number((int)num));
+        return;
     }
-    int res=vm.gc_get(value_stack.top()).get_vector().get_value_address((int)num);
+    int res=ref.get_value_address((int)num);
     if(res<0)
     {
         die("slc: index out of range");
         return;
     }
-    vm.add_reference(res);
-    vm.gc_get(slice_stack.top()).get_vector().add_elem(res);
-    vm.del_reference(val_addr);
+    aim.add_elem(res);
     return;
 }
 void nasal_bytecode_vm::opr_slice2()
 {
-    int val_addr2=value_stack.top();
-    value_stack.pop();
-    int val_addr1=value_stack.top();
-    value_stack.pop();
-    nasal_vector& ref=vm.gc_get(value_stack.top()).get_vector();
-    nasal_vector& aim=vm.gc_get(slice_stack.top()).get_vector();
+    nasal_ref val2=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref val1=value_stack.back();
+    value_stack.pop_back();
+    nasal_vector& ref=vm.gc_get(value_stack.back().value.addr).get_vector();
+    nasal_vector& aim=vm.gc_get(slice_stack.back()).get_vector();
+    vm.gc_write_barrier(slice_stack.back());
 
-    int type1=vm.gc_get(val_addr1).get_type();
+    int type1=val1.type;
     int num1;
     switch(type1)
     {
         case vm_nil:break;
-        case vm_number:num1=(int)vm.gc_get(val_addr1).get_number();break;
-        case vm_string:num1=(int)trans_string_to_number(vm.gc_get(val_addr1).get_string());break;
-        default:die("slc2: error value type");break;
+        case vm_number:
+        case vm_string:num1=(int)ref_to_number(val1);break;
+        default:die("slc2: error value type");return;
     }
-    int type2=vm.gc_get(val_addr2).get_type();
+    int type2=val2.type;
     int num2;
     switch(type2)
     {
         case vm_nil:break;
-        case vm_number:num2=(int)vm.gc_get(val_addr2).get_number();break;
-        case vm_string:num2=(int)trans_string_to_number(vm.gc_get(val_addr2).get_string());break;
-        default:die("slc2: error value type");break;
+        case vm_number:
+        case vm_string:num2=(int)ref_to_number(val2);break;
+        default:die("slc2: error value type");return;
     }
     int ref_size=ref.size();
     if(type1==vm_nil && type2==vm_nil)
@@ -1355,114 +1567,340 @@ void nasal_bytecode_vm::opr_slice2()
         die("slc2: begin or end index out of range");
         return;
     }
-    for(int i=num1;i<num2;++i)
+    // slice of continuous range shares the buffer of the vector until one of them is changed
+    if(!aim.size() && (num1<0)==(num2<0))
     {
-        int tmp=ref.get_value_address(i);
-        vm.add_reference(tmp);
-        aim.add_elem(tmp);
+        if(num1<0)
+        {
+            num1+=ref_size;
+            num2+=ref_size;
+        }
+        aim.set_slice(ref,num1,num2);
     }
-    vm.del_reference(val_addr1);
-    vm.del_reference(val_addr2);
+    else if(ref.is_packed())
+        for(int i=num1;i<num2;++i)
+            aim.add_number(ref.get_number(i));
+    else
+        for(int i=num1;i<num2;++i)
+        {
+            int tmp=ref.get_value_address(i);
+            aim.add_elem(tmp);
+        }
     return;
 }
 void nasal_bytecode_vm::opr_mcall()
 {
-    int mem_addr=-1;
-    if(local_scope_stack.top()>=0)
-        mem_addr=vm.gc_get(local_scope_stack.top()).get_closure().get_mem_address(string_table[exec_code[ptr].index]);
-    if(mem_addr<0)
-        mem_addr=vm.gc_get(global_scope_addr).get_closure().get_mem_address(string_table[exec_code[ptr].index]);
-    if(mem_addr<0)
+    int closure_addr;
+    int* mem_addr=name_mem_address(closure_addr);
+    if(!mem_addr)
+    {
         die("mcall: cannot find symbol named \""+string_table[exec_code[ptr].index]+"\"");
-    value_stack.push(mem_addr);
+        return;
+    }
+    vm.gc_write_barrier(closure_addr);
+    mem_stack.push(mem_addr);
     return;
 }
-void nasal_bytecode_vm::opr_mcallv()
+void nasal_bytecode_vm::opr_mcallg()
 {
-    int val_addr=value_stack.top();
-    value_stack.pop();
-    int vec_addr=vm.mem_get(value_stack.top());
-    value_stack.pop();
-    int type=vm.gc_get(vec_addr).get_type();
-    if(type==vm_string)
+    nasal_closure& ref=vm.gc_get(global_scope_addr).get_closure();
+    int* mem_addr=ref.get_local_mem(exec_code[ptr].index);
+    if(!mem_addr)
     {
-        die("mcallv: cannot get memory space in a string");
+        die("mcall: cannot find symbol named \""+ref.get_local_name(exec_code[ptr].index)+"\"");
         return;
     }
+    vm.gc_write_barrier(global_scope_addr);
+    mem_stack.push(mem_addr);
+    return;
+}
+void nasal_bytecode_vm::opr_mcalll()
+{
+    int* mem_addr=local_mem_address(exec_code[ptr].index);
+    if(!mem_addr)
+        return;
+    mem_stack.push(mem_addr);
+    return;
+}
+void nasal_bytecode_vm::opr_mcallv()
+{
+    // vector/hash is on the value stack,only the last member call gets a slot
+    nasal_ref val=value_stack.back();
+    value_stack.pop_back();
+    nasal_ref vec=value_stack.back();
+    value_stack.pop_back();
+    int type=vec.type;
     if(type==vm_vector)
     {
         int num;
-        switch(vm.gc_get(val_addr).get_type())
+        switch(val.type)
         {
-            case vm_number:num=(int)vm.gc_get(val_addr).get_number();break;
-            case vm_string:num=(int)trans_string_to_number(vm.gc_get(val_addr).get_string());break;
-            default:die("mcallv: error value type");break;
+            case vm_number:
+            case vm_string:num=(int)ref_to_number(val);break;
+            default:die("mcallv: error value type");return;
         }
-        int res=vm.gc_get(vec_addr).get_vector().get_mem_address(num);
-        if(res<0)
+        nasal_vector& ref=vm.gc_get(vec.value.addr).get_vector();
+        vm.gc_write_barrier(vec.value.addr);
+        if(ref.is_packed() && ref.check_index(num))
+        {
+            mem_stack.push(nasal_mem_slot(&ref,num<0? num+ref.size():num));
+            return;
+        }
+        int* res=ref.get_mem_address(num);
+        if(!res)
         {
             die("mcallv: index out of range");
             return;
         }
-        value_stack.push(res);
+        mem_stack.push(res);
     }
     else if(type==vm_hash)
     {
-        if(vm.gc_get(val_addr).get_type()!=vm_string)
+        if(val.type!=vm_string)
         {
             die("mcallv: must use string as the key");
             return;
         }
-        int res=vm.gc_get(vec_addr).get_hash().get_mem_address(vm.gc_get(val_addr).get_string());
-        if(res<0)
+        int* res=vm.gc_get(vec.value.addr).get_hash().get_mem_address(vm.gc_get(val.value.addr).get_string(),vm.gc_string_hash(val.value.addr));
+        if(!res)
         {
-            die("mcallv: cannot find member \""+vm.gc_get(val_addr).get_string()+"\" of this hash");
+            die("mcallv: cannot find member \""+vm.gc_get(val.value.addr).get_string()+"\" of this hash");
             return;
         }
-        value_stack.push(res);
+        vm.gc_write_barrier(vec.value.addr);
+        mem_stack.push(res);
     }
-    vm.del_reference(val_addr);
+    else if(type==vm_string)
+        die("mcallv: cannot get memory space in a string");
+    else
+        die("mcallv: must call a vector/hash");
     return;
 }
 void nasal_bytecode_vm::opr_mcallh()
 {
-    int mem_addr=-1;
-    int hash_addr=vm.mem_get(value_stack.top());
-    value_stack.pop();
-    if(vm.gc_get(hash_addr).get_type()!=vm_hash)
+    nasal_ref hash=value_stack.back();
+    value_stack.pop_back();
+    if(hash.type!=vm_hash)
     {
         die("mcallh: must call a hash");
         return;
     }
-    mem_addr=vm.gc_get(hash_addr).get_hash().get_mem_address(string_table[exec_code[ptr].index]);
-    if(mem_addr<0)
+    nasal_hash& ref=vm.gc_get(hash.value.addr).get_hash();
+    nasal_inline_cache& cache=inline_cache[ptr];
+    int* mem_addr;
+    // only members of the hash itself are cached,members in parents need write barrier of their owners
+    if(ref.get_shape()==cache.shape)
+        mem_addr=ref.get_slot_mem(cache.slot);
+    else
+    {
+        mem_addr=ref.get_mem_address(string_table[exec_code[ptr].index],string_hash[exec_code[ptr].index]);
+        nasal_shape* shape=ref.get_shape();
+        int slot;
+        // changing parents of prototypes makes shape_epoch change,so it is not cached
+        if(mem_addr && !shape->dict && ref.get_owner(string_table[exec_code[ptr].index],string_hash[exec_code[ptr].index],slot)==&ref && slot!=shape->parents_slot)
+        {
+            cache.shape=shape;
+            cache.slot=slot;
+        }
+    }
+    if(!mem_addr)
     {
         die("mcallh: cannot get memory space in this hash");
         return;
     }
-    value_stack.push(mem_addr);
+    vm.gc_write_barrier(hash.value.addr);
+    mem_stack.push(mem_addr);
     return;
 }
 void nasal_bytecode_vm::opr_return()
 {
-    int closure_addr=local_scope_stack.top();
-    local_scope_stack.pop();
-    vm.gc_get(closure_addr).get_closure().del_scope();
-    vm.del_reference(closure_addr);
-    ptr=call_stack.top();
-    call_stack.pop();
-    int tmp=value_stack.top();
-    value_stack.pop();
+    ptr=call_frame.back().ret;
+    frame_stack.resize(call_frame.back().base);
+    call_frame.pop_back();
+    nasal_ref tmp=value_stack.back();
+    value_stack.pop_back();
     // delete function
-    vm.del_reference(value_stack.top());
-    value_stack.pop();
-    value_stack.push(tmp);
+    value_stack.pop_back();
+    value_stack.push_back(tmp);
+    return;
+}
+void nasal_bytecode_vm::opr_rmov()
+{
+    opreg& reg=reg_table[exec_code[ptr].index];
+    nasal_ref val=reg_load(reg.a);
+    if(!error)
+        reg_store(reg.dst,val);
+    return;
+}
+void nasal_bytecode_vm::opr_radd()
+{
+    opreg& reg=reg_table[exec_code[ptr].index];
+    nasal_ref val1=reg_load(reg.a);
+    if(error)
+        return;
+    nasal_ref val2=reg_load(reg.b);
+    if(!error)
+        reg_store(reg.dst,nasal_ref(ref_to_number(val1)+ref_to_number(val2)));
+    return;
+}
+void nasal_bytecode_vm::opr_rsub()
+{
+    opreg& reg=reg_table[exec_code[ptr].index];
+    nasal_ref val1=reg_load(reg.a);
+    if(error)
+        return;
+    nasal_ref val2=reg_load(reg.b);
+    if(!error)
+        reg_store(reg.dst,nasal_ref(ref_to_number(val1)-ref_to_number(val2)));
+    return;
+}
+void nasal_bytecode_vm::opr_rmul()
+{
+    opreg& reg=reg_table[exec_code[ptr].index];
+    nasal_ref val1=reg_load(reg.a);
+    if(error)
+        return;
+    nasal_ref val2=reg_load(reg.b);
+    if(!error)
+        reg_store(reg.dst,nasal_ref(ref_to_number(val1)*ref_to_number(val2)));
+    return;
+}
+void nasal_bytecode_vm::opr_rdiv()
+{
+    opreg& reg=reg_table[exec_code[ptr].index];
+    nasal_ref val1=reg_load(reg.a);
+    if(error)
+        return;
+    nasal_ref val2=reg_load(reg.b);
+    if(!error)
+        reg_store(reg.dst,nasal_ref(ref_to_number(val1)/ref_to_number(val2)));
+    return;
+}
+void nasal_bytecode_vm::opr_rjf()
+{
+    opreg& reg=reg_table[exec_code[ptr].index];
+    nasal_ref val1=reg_load(reg.a);
+    if(error)
+        return;
+    nasal_ref val2=reg_load(reg.b);
+    if(error)
+        return;
+    bool result;
+    if(reg.cmp==op_eq || reg.cmp==op_neq)
+        result=(ref_equal(val1,val2)==(reg.cmp==op_eq));
+    else if(val1.type==vm_string && val2.type==vm_string)
+    {
+        const std::string& str1=vm.gc_get(val1.value.addr).get_string();
+        const std::string& str2=vm.gc_get(val2.value.addr).get_string();
+        switch(reg.cmp)
+        {
+            case op_less:result=(str1<str2); break;
+            case op_leq: result=(str1<=str2);break;
+            case op_grt: result=(str1>str2); break;
+            default:     result=(str1>=str2);break;
+        }
+    }
+    else
+    {
+        double num1=ref_to_number(val1);
+        double num2=ref_to_number(val2);
+        switch(reg.cmp)
+        {
+            case op_less:result=(num1<num2); break;
+            case op_leq: result=(num1<=num2);break;
+            case op_grt: result=(num1>num2); break;
+            default:     result=(num1>=num2);break;
+        }
+    }
+    if(!result)
+        ptr=reg.dst.index-1;
+    return;
+}
+void nasal_bytecode_vm::opr_pone_mcalll_addeq_pop()
+{
+    opr_pushone();
+    ++ptr;
+    opr_mcalll_addeq_pop();
+    return;
+}
+void nasal_bytecode_vm::opr_less_jf_pop()
+{
+    opr_less();
+    ++ptr;
+    opr_jf_pop();
+    return;
+}
+void nasal_bytecode_vm::opr_mcalll_addeq_pop()
+{
+    // ptr stays at the opcode that fails,so error shows the right place
+    opr_mcalll();
+    if(error)
+        return;
+    ++ptr;
+    opr_addeq();
+    ++ptr;
+    value_stack.pop_back();
+    return;
+}
+void nasal_bytecode_vm::opr_mcalll_meq_pop()
+{
+    opr_mcalll();
+    if(error)
+        return;
+    ++ptr;
+    opr_meq();
+    ++ptr;
+    value_stack.pop_back();
+    return;
+}
+void nasal_bytecode_vm::opr_jf_pop()
+{
+    if(!check_condition(value_stack.back()))
+    {
+        ptr=exec_code[ptr].index-1;
+        return;
+    }
+    ++ptr;
+    value_stack.pop_back();
+    return;
+}
+void nasal_bytecode_vm::opr_calll_calll()
+{
+    opr_calll();
+    if(error)
+        return;
+    ++ptr;
+    opr_calll();
     return;
 }
-void nasal_bytecode_vm::run(std::vector<std::string>& strs,std::vector<double>& nums,std::vector<opcode>& exec)
+void nasal_bytecode_vm::opr_callb_ret()
+{
+    opr_builtincall();
+    if(error)
+        return;
+    ++ptr;
+    opr_return();
+    return;
+}
+void nasal_bytecode_vm::opr_pop_jmp()
+{
+    value_stack.pop_back();
+    ptr=exec_code[ptr+1].index-1;
+    return;
+}
+void nasal_bytecode_vm::run(std::vector<std::string>& strs,std::vector<double>& nums,std::vector<opcode>& exec,std::vector<std::vector<std::string> >& syms,std::vector<std::vector<std::string> >& captures,std::vector<opreg>& regs)
 {
     string_table=strs;
     number_table=nums;
+    reg_table=regs;
+    symbol_table.resize(syms.size());
+    for(int i=0;i<(int)syms.size();++i)
+        for(int j=0;j<(int)syms[i].size();++j)
+            symbol_table[i].insert(syms[i][j],nasal_hashmap::hash(syms[i][j]));
+    capture_table.resize(captures.size());
+    for(int i=0;i<(int)captures.size();++i)
+        for(int j=0;j<(int)captures[i].size();++j)
+            capture_table[i].insert(captures[i][j],nasal_hashmap::hash(captures[i][j]));
     int size=exec.size();
     for(int i=0;i<size;++i)
     {
@@ -1472,21 +1910,256 @@ void nasal_bytecode_vm::run(std::vector<std::string>& strs,std::vector<double>&
     }
     
     error=0;
+    // nursery is built again by clear(),the heap is empty now
+    if(nursery_size)
+    {
+        vm.set_nursery_size(nursery_size);
+        vm.clear();
+        nursery_size=0;
+    }
     global_scope_addr=vm.gc_alloc(vm_closure);
-    size=exec_code.size();
+    nasal_closure& global_closure=vm.gc_get(global_scope_addr).get_closure();
+    global_closure.del_scope();
+    global_closure.add_scope(&symbol_table[0]);
+    builtin_scope_addr=vm.gc_alloc(vm_closure);
+    // same strings share one address,so equal constants compare by address
+    for(int i=0;i<(int)string_table.size();++i)
+    {
+        string_addr.push_back(vm.gc_intern(string_table[i]));
+        string_hash.push_back(vm.gc_string_hash(string_addr[i]));
+    }
+    // constants are boxed once when they are first stored
+    for(int i=0;i<(int)number_table.size();++i)
+        vm.gc_pin_number(number_table[i]);
+    inline_cache.assign(exec_code.size(),nasal_inline_cache());
+    name_cache.assign(exec_code.size(),nasal_name_cache());
+    op_profile.new_run();
     time_t begin_time=std::time(NULL);
-    for(ptr=0;ptr<size;++ptr)
+    // each opcode goes to the next one directly by computed goto,or by switch if labels as values are not supported
+    // opcodes that cannot fail or allocate skip the check of error and gc
+#ifdef NASAL_COMPUTED_GOTO
+    static void* label_table[]=
+    {
+        &&l_op_nop,
+        &&l_op_loadg,
+        &&l_op_loadl,
+        &&l_op_pushnum,
+        &&l_op_pushone,
+        &&l_op_pushzero,
+        &&l_op_pushnil,
+        &&l_op_pushstr,
+        &&l_op_newvec,
+        &&l_op_newhash,
+        &&l_op_newfunc,
+        &&l_op_vecapp,
+        &&l_op_hashapp,
+        &&l_op_para,
+        &&l_op_defpara,
+        &&l_op_dynpara,
+        &&l_op_entry,
+        &&l_op_unot,
+        &&l_op_usub,
+        &&l_op_add,
+        &&l_op_sub,
+        &&l_op_mul,
+        &&l_op_div,
+        &&l_op_lnk,
+        &&l_op_addeq,
+        &&l_op_subeq,
+        &&l_op_muleq,
+        &&l_op_diveq,
+        &&l_op_lnkeq,
+        &&l_op_meq,
+        &&l_op_eq,
+        &&l_op_neq,
+        &&l_op_less,
+        &&l_op_leq,
+        &&l_op_grt,
+        &&l_op_geq,
+        &&l_op_pop,
+        &&l_op_jmp,
+        &&l_op_jmptrue,
+        &&l_op_jmpfalse,
+        &&l_op_counter,
+        &&l_op_forindex,
+        &&l_op_foreach,
+        &&l_op_call,
+        &&l_op_callg,
+        &&l_op_calll,
+        &&l_op_callv,
+        &&l_op_callvi,
+        &&l_op_callh,
+        &&l_op_callf,
+        &&l_op_builtincall,
+        &&l_op_slicebegin,
+        &&l_op_sliceend,
+        &&l_op_slice,
+        &&l_op_slice2,
+        &&l_op_mcall,
+        &&l_op_mcallg,
+        &&l_op_mcalll,
+        &&l_op_mcallv,
+        &&l_op_mcallh,
+        &&l_op_return,
+        &&l_op_rmov,
+        &&l_op_radd,
+        &&l_op_rsub,
+        &&l_op_rmul,
+        &&l_op_rdiv,
+        &&l_op_rjf,
+        &&l_op_pone_mcalll_addeq_pop,
+        &&l_op_less_jf_pop,
+        &&l_op_mcalll_addeq_pop,
+        &&l_op_mcalll_meq_pop,
+        &&l_op_jf_pop,
+        &&l_op_calll_calll,
+        &&l_op_callb_ret,
+        &&l_op_pop_jmp,
+        &&l_op_exit
+    };
+    // in profile mode every opcode goes to vm_profile first
+    static void* profile_table[op_exit+1];
+    for(int i=0;i<=op_exit;++i)
+        profile_table[i]=&&vm_profile;
+    void** dispatch=profile? profile_table:label_table;
+#define VM_OP(op) l_##op:
+#define VM_NEXT goto *dispatch[exec_code[++ptr].op]
+#define VM_CHECK goto vm_check
+    ptr=0;
+    goto *dispatch[exec_code[ptr].op];
+    {
+vm_profile:
+        op_profile.add(exec_code[ptr].op);
+        goto *label_table[exec_code[ptr].op];
+#else
+#define VM_OP(op) case op:
+#define VM_NEXT continue
+#define VM_CHECK break
+    for(ptr=0;;++ptr)
     {
-        (this->*opr_table[exec_code[ptr].op])();
+        if(profile)
+            op_profile.add(exec_code[ptr].op);
+        switch(exec_code[ptr].op)
+        {
+#endif
+        VM_OP(op_nop)          opr_nop();          VM_NEXT;
+        VM_OP(op_loadg)        opr_loadg();        VM_CHECK;
+        VM_OP(op_loadl)        opr_loadl();        VM_CHECK;
+        VM_OP(op_pushnum)      opr_pushnum();      VM_NEXT;
+        VM_OP(op_pushone)      opr_pushone();      VM_NEXT;
+        VM_OP(op_pushzero)     opr_pushzero();     VM_NEXT;
+        VM_OP(op_pushnil)      opr_pushnil();      VM_NEXT;
+        VM_OP(op_pushstr)      opr_pushstr();      VM_NEXT;
+        VM_OP(op_newvec)       opr_newvec();       VM_CHECK;
+        VM_OP(op_newhash)      opr_newhash();      VM_CHECK;
+        VM_OP(op_newfunc)      opr_newfunc();      VM_CHECK;
+        VM_OP(op_vecapp)       opr_vecapp();       VM_CHECK;
+        VM_OP(op_hashapp)      opr_hashapp();      VM_CHECK;
+        VM_OP(op_para)         opr_para();         VM_CHECK;
+        VM_OP(op_defpara)      opr_defpara();      VM_CHECK;
+        VM_OP(op_dynpara)      opr_dynpara();      VM_CHECK;
+        VM_OP(op_entry)        opr_entry();        VM_CHECK;
+        VM_OP(op_unot)         opr_unot();         VM_CHECK;
+        VM_OP(op_usub)         opr_usub();         VM_CHECK;
+        VM_OP(op_add)          opr_add();          VM_CHECK;
+        VM_OP(op_sub)          opr_sub();          VM_CHECK;
+        VM_OP(op_mul)          opr_mul();          VM_CHECK;
+        VM_OP(op_div)          opr_div();          VM_CHECK;
+        VM_OP(op_lnk)          opr_lnk();          VM_CHECK;
+        VM_OP(op_addeq)        opr_addeq();        VM_CHECK;
+        VM_OP(op_subeq)        opr_subeq();        VM_CHECK;
+        VM_OP(op_muleq)        opr_muleq();        VM_CHECK;
+        VM_OP(op_diveq)        opr_diveq();        VM_CHECK;
+        VM_OP(op_lnkeq)        opr_lnkeq();        VM_CHECK;
+        VM_OP(op_meq)          opr_meq();          VM_CHECK;
+        VM_OP(op_eq)           opr_eq();           VM_CHECK;
+        VM_OP(op_neq)          opr_neq();          VM_CHECK;
+        VM_OP(op_less)         opr_less();         VM_CHECK;
+        VM_OP(op_leq)          opr_leq();          VM_CHECK;
+        VM_OP(op_grt)          opr_grt();          VM_CHECK;
+        VM_OP(op_geq)          opr_geq();          VM_CHECK;
+        VM_OP(op_pop)          opr_pop();          VM_NEXT;
+        VM_OP(op_jmp)          opr_jmp();          VM_NEXT;
+        VM_OP(op_jmptrue)      opr_jmptrue();      VM_NEXT;
+        VM_OP(op_jmpfalse)     opr_jmpfalse();     VM_NEXT;
+        VM_OP(op_counter)      opr_counter();      VM_CHECK;
+        VM_OP(op_forindex)     opr_forindex();     VM_CHECK;
+        VM_OP(op_foreach)      opr_foreach();      VM_CHECK;
+        VM_OP(op_call)         opr_call();         VM_CHECK;
+        VM_OP(op_callg)        opr_callg();        VM_CHECK;
+        VM_OP(op_calll)        opr_calll();        VM_CHECK;
+        VM_OP(op_callv)        opr_callv();        VM_CHECK;
+        VM_OP(op_callvi)       opr_callvi();       VM_CHECK;
+        VM_OP(op_callh)        opr_callh();        VM_CHECK;
+        VM_OP(op_callf)        opr_callf();        VM_CHECK;
+        VM_OP(op_builtincall)  opr_builtincall();  VM_CHECK;
+        VM_OP(op_slicebegin)   opr_slicebegin();   VM_CHECK;
+        VM_OP(op_sliceend)     opr_sliceend();     VM_CHECK;
+        VM_OP(op_slice)        opr_slice();        VM_CHECK;
+        VM_OP(op_slice2)       opr_slice2();       VM_CHECK;
+        VM_OP(op_mcall)        opr_mcall();        VM_CHECK;
+        VM_OP(op_mcallg)       opr_mcallg();       VM_CHECK;
+        VM_OP(op_mcalll)       opr_mcalll();       VM_CHECK;
+        VM_OP(op_mcallv)       opr_mcallv();       VM_CHECK;
+        VM_OP(op_mcallh)       opr_mcallh();       VM_CHECK;
+        VM_OP(op_return)       opr_return();       VM_CHECK;
+        VM_OP(op_rmov)         opr_rmov();         VM_CHECK;
+        VM_OP(op_radd)         opr_radd();         VM_CHECK;
+        VM_OP(op_rsub)         opr_rsub();         VM_CHECK;
+        VM_OP(op_rmul)         opr_rmul();         VM_CHECK;
+        VM_OP(op_rdiv)         opr_rdiv();         VM_CHECK;
+        VM_OP(op_rjf)          opr_rjf();          VM_CHECK;
+        VM_OP(op_pone_mcalll_addeq_pop)opr_pone_mcalll_addeq_pop();VM_CHECK;
+        VM_OP(op_less_jf_pop)  opr_less_jf_pop();  VM_NEXT;
+        VM_OP(op_mcalll_addeq_pop)opr_mcalll_addeq_pop();VM_CHECK;
+        VM_OP(op_mcalll_meq_pop)opr_mcalll_meq_pop();VM_CHECK;
+        VM_OP(op_jf_pop)       opr_jf_pop();       VM_NEXT;
+        VM_OP(op_calll_calll)  opr_calll_calll();  VM_CHECK;
+        VM_OP(op_callb_ret)    opr_callb_ret();    VM_CHECK;
+        VM_OP(op_pop_jmp)      opr_pop_jmp();      VM_NEXT;
+        VM_OP(op_exit)         goto vm_exit;
+#ifdef NASAL_COMPUTED_GOTO
+vm_check:
+#else
+        }
+#endif
         if(error)
-            break;
+            goto vm_exit;
+        // slots in mem_stack may be moved by gc,so collect only when it is empty
+        // work asked by gcidle in script is done here with its own budget
+        if(vm.gc_need_collect() && mem_stack.empty())
+        {
+            collect_garbage(vm.gc_take_idle());
+            if(vm.gc_out_of_memory())
+            {
+                die("out of memory: heap limit is exceeded");
+                goto vm_exit;
+            }
+        }
+#ifdef NASAL_COMPUTED_GOTO
+        VM_NEXT;
+#endif
     }
+#undef VM_OP
+#undef VM_NEXT
+#undef VM_CHECK
+vm_exit:
     time_t end_time=std::time(NULL);
     time_t total_run_time=end_time-begin_time;
     if(total_run_time>=1)
         std::cout<<">> [vm] process exited after "<<total_run_time<<"s.\n";
-    vm.del_reference(global_scope_addr);
-
+    last_gc_stat=vm.gc_stat();
+    if(show_gc_stat)
+        vm.gc_stat_print();
+    if(heap_dump_file.length())
+    {
+        std::vector<int> roots;
+        gc_roots(this,roots);
+        if(vm.gc_dump(heap_dump_file,roots))
+            std::cout<<">> [vm] heap snapshot is written to <\""<<heap_dump_file<<"\">.\n";
+        else
+            std::cout<<">> [vm] cannot write heap snapshot to <\""<<heap_dump_file<<"\">.\n";
+    }
     clear();
     return;
 }
@@ -4,7 +4,8 @@
 enum op_code
 {
     op_nop,
-    op_load,// load value in value_stack to identifier
+    op_loadg,      // load value in value_stack to global slot
+    op_loadl,      // load value in value_stack to local slot
     op_pushnum,
     op_pushone,
     op_pushzero,
@@ -24,7 +25,9 @@ enum op_code
     op_counter,    // add counter for forindex/foreach
     op_forindex,   // index counter on the top of forindex_stack plus 1
     op_foreach,    // index counter on the top of forindex_stack plus 1 and get the value in vector
-    op_call,       // call identifier
+    op_call,       // call identifier by name,used by values of outer functions
+    op_callg,      // call global slot
+    op_calll,      // call local slot
     op_callv,      // call vec[index]
     op_callvi,     // call vec[immediate] (used in multi-assign/multi-define)
     op_callh,      // call hash.label
@@ -34,10 +37,27 @@ enum op_code
     op_sliceend,   // end of slice
     op_slice,      // slice like vec[1]
     op_slice2,     // slice like vec[nil:10]
-    op_mcall,      // get memory of identifier
+    op_mcall,      // get memory of identifier by name
+    op_mcallg,     // get memory of global slot
+    op_mcalll,     // get memory of local slot
     op_mcallv,     // get memory of vec[index]
     op_mcallh,     // get memory of hash.label
-    op_return      // return
+    op_return,     // return
+    op_rmov,       // register mode: dst=a
+    op_radd,       // register mode: dst=a+b
+    op_rsub,       // register mode: dst=a-b
+    op_rmul,       // register mode: dst=a*b
+    op_rdiv,       // register mode: dst=a/b
+    op_rjf,        // register mode: jump to dst if a cmp b is false
+    op_pone_mcalll_addeq_pop, // superinstructions: opcodes of the sequence in one dispatch
+    op_less_jf_pop,
+    op_mcalll_addeq_pop,
+    op_mcalll_meq_pop,
+    op_jf_pop,
+    op_calll_calll,
+    op_callb_ret,
+    op_pop_jmp,
+    op_exit        // end of byte codes
 };
 
 struct
@@ -47,7 +67,8 @@ struct
 }code_table[]=
 {
     {op_nop,         "nop   "},
-    {op_load,        "load  "},
+    {op_loadg,       "loadg "},
+    {op_loadl,       "loadl "},
     {op_pushnum,     "pnum  "},
     {op_pushone,     "pone  "},
     {op_pushzero,    "pzero "},
@@ -89,6 +110,8 @@ struct
     {op_forindex,    "findx "},
     {op_foreach,     "feach "},
     {op_call,        "call  "},
+    {op_callg,       "callg "},
+    {op_calll,       "calll "},
     {op_callv,       "callv "},
     {op_callvi,      "callvi"},
     {op_callh,       "callh "},
@@ -99,12 +122,52 @@ struct
     {op_slice,       "slc   "},
     {op_slice2,      "slc2  "},
     {op_mcall,       "mcall "},
+    {op_mcallg,      "mcallg"},
+    {op_mcalll,      "mcalll"},
     {op_mcallv,      "mcallv"},
     {op_mcallh,      "mcallh"},
     {op_return,      "ret   "},
+    {op_rmov,        "rmov  "},
+    {op_radd,        "radd  "},
+    {op_rsub,        "rsub  "},
+    {op_rmul,        "rmult "},
+    {op_rdiv,        "rdiv  "},
+    {op_rjf,         "rjf   "},
+    {op_pone_mcalll_addeq_pop,"pone+mcalll+addeq+pop"},
+    {op_less_jf_pop, "l+jf+pop"},
+    {op_mcalll_addeq_pop,"mcalll+addeq+pop"},
+    {op_mcalll_meq_pop,"mcalll+memeq+pop"},
+    {op_jf_pop,      "jf+pop"},
+    {op_calll_calll, "calll+calll"},
+    {op_callb_ret,   "callb+ret"},
+    {op_pop_jmp,     "pop+jmp"},
+    {op_exit,        "exit  "},
     {-1,             NULL},
 };
 
+/*
+superinstructions: frequent sequences in the profile of prof command are fused into one opcode
+longer sequences are put first,the first opcode of a sequence is replaced and the others are kept,
+so jumps into the middle of a sequence still work and the superinstruction skips the others
+*/
+struct
+{
+    unsigned char super;
+    int size;
+    unsigned char seq[4];
+}super_table[]=
+{
+    {op_pone_mcalll_addeq_pop,4,{op_pushone,op_mcalll,op_addeq,op_pop}},
+    {op_less_jf_pop,          3,{op_less,op_jmpfalse,op_pop}},
+    {op_mcalll_addeq_pop,     3,{op_mcalll,op_addeq,op_pop}},
+    {op_mcalll_meq_pop,       3,{op_mcalll,op_meq,op_pop}},
+    {op_jf_pop,               2,{op_jmpfalse,op_pop}},
+    {op_calll_calll,          2,{op_calll,op_calll}},
+    {op_callb_ret,            2,{op_builtincall,op_return}},
+    {op_pop_jmp,              2,{op_pop,op_jmp}},
+    {0,                       0,{0}}
+};
+
 struct opcode
 {
     unsigned char op;
@@ -123,6 +186,44 @@ struct opcode
     }
 };
 
+/*
+opreg: operands of register opcodes,index of these opcodes is the place in reg_table
+register opcodes are three-address opcodes that read and write slots directly without the value stack
+*/
+enum reg_operand_type
+{
+    reg_number=0,  // number_table[index]
+    reg_local,     // local slot,found by name if it is not defined yet like calll/mcalll
+    reg_global,    // global slot
+    reg_new_local, // local slot defined by this opcode like loadl
+    reg_new_global // global slot defined by this opcode like loadg
+};
+
+struct reg_operand
+{
+    unsigned char type;
+    unsigned int index;
+    reg_operand()
+    {
+        type=reg_number;
+        index=0;
+        return;
+    }
+};
+
+struct opreg
+{
+    unsigned char cmp; // comparison of rjf:op_eq,op_neq,op_less,op_leq,op_grt,op_geq
+    reg_operand dst;   // index of dst is the place to jump in rjf
+    reg_operand a;
+    reg_operand b;
+    opreg()
+    {
+        cmp=op_nop;
+        return;
+    }
+};
+
 // unfinished
 // now it can output ast but it is not byte code yet
 // please wait...
@@ -136,9 +237,32 @@ private:
     std::vector<opcode> exec_code;
     std::vector<int> continue_ptr;
     std::vector<int> break_ptr;
+    // names of slots,symbol_table[0] is the global scope and others are scopes of functions
+    std::vector<std::vector<std::string> > symbol_table;
+    std::map<std::string,int> global;
+    // names that functions find in closure,capture_table[i] is used by function of symbol_table[i]
+    std::vector<std::vector<std::string> > capture_table;
+    // local scopes of functions being generated,the innermost one is at the back
+    std::list<std::map<std::string,int> > local;
+    std::list<std::vector<std::string> > capture;
+    // register mode: assignments and conditions of slots and numbers use register opcodes
+    bool reg_mode;
+    std::vector<opreg> reg_table;
     int error;
     void regist_number(double);
     void regist_string(std::string);
+    void find_symbol(nasal_ast&,std::vector<std::string>&);
+    void add_symbol(std::vector<std::string>&,const std::string&);
+    int  new_scope(std::vector<std::string>&);
+    bool outer_symbol(const std::string&);
+    void id_gen(const std::string&,unsigned char,unsigned char,unsigned char);
+    bool reg_operand_gen(nasal_ast&,reg_operand&);
+    bool reg_value_gen(nasal_ast&,opreg&,unsigned char&);
+    void reg_code_gen(unsigned char,opreg&);
+    bool reg_gen(nasal_ast&);
+    bool reg_cond_gen(nasal_ast&);
+    void set_jump(int,int);
+    void super_gen();
     void pop_gen();
     void nil_gen();
     void number_gen(nasal_ast&);
@@ -174,17 +298,30 @@ private:
     void return_gen(nasal_ast&);
 public:
     nasal_codegen();
+    void set_register_mode(bool);// use register opcodes where it can,stack opcodes are used by default
     void main_progress(nasal_ast&);
     void print_op(int);
+    void print_reg_operand(reg_operand&);
+    void print_reg(opreg&,unsigned char);
     void print_byte_code();
     std::vector<std::string>& get_string_table();
     std::vector<double>& get_number_table();
     std::vector<opcode>& get_exec_code();
+    std::vector<std::vector<std::string> >& get_symbol_table();
+    std::vector<std::vector<std::string> >& get_capture_table();
+    std::vector<opreg>& get_reg_table();
 };
 
 nasal_codegen::nasal_codegen()
 {
     error=0;
+    reg_mode=false;
+    return;
+}
+
+void nasal_codegen::set_register_mode(bool enable)
+{
+    reg_mode=enable;
     return;
 }
 
@@ -204,6 +341,253 @@ void nasal_codegen::regist_string(std::string str)
     return;
 }
 
+void nasal_codegen::add_symbol(std::vector<std::string>& names,const std::string& str)
+{
+    for(int i=0;i<(int)names.size();++i)
+        if(names[i]==str)
+            return;
+    names.push_back(str);
+    return;
+}
+
+void nasal_codegen::find_symbol(nasal_ast& node,std::vector<std::string>& names)
+{
+    // values defined in inner functions belong to their own scopes
+    int type=node.get_type();
+    if(type==ast_function)
+        return;
+    if(type==ast_definition)
+    {
+        nasal_ast& def=node.get_children()[0];
+        if(def.get_type()==ast_identifier)
+            add_symbol(names,def.get_str());
+        else
+            for(int i=0;i<(int)def.get_children().size();++i)
+                add_symbol(names,def.get_children()[i].get_str());
+    }
+    else if(type==ast_new_iter)
+        add_symbol(names,node.get_children()[0].get_str());
+    int size=node.get_children().size();
+    for(int i=0;i<size;++i)
+        find_symbol(node.get_children()[i],names);
+    return;
+}
+
+int nasal_codegen::new_scope(std::vector<std::string>& names)
+{
+    std::map<std::string,int> scope;
+    for(int i=0;i<(int)names.size();++i)
+        scope[names[i]]=i;
+    if(symbol_table.empty())
+        global=scope;
+    else
+    {
+        local.push_back(scope);
+        capture.push_back(std::vector<std::string>());
+    }
+    symbol_table.push_back(names);
+    capture_table.push_back(std::vector<std::string>());
+    return symbol_table.size()-1;
+}
+
+bool nasal_codegen::outer_symbol(const std::string& str)
+{
+    // "me" given by callh and values of outer functions are found by name in closure
+    if(str=="me")
+        return true;
+    if(local.empty())
+        return false;
+    std::list<std::map<std::string,int> >::iterator last=--local.end();
+    for(std::list<std::map<std::string,int> >::iterator i=local.begin();i!=last;++i)
+        if(i->count(str))
+            return true;
+    return false;
+}
+
+void nasal_codegen::id_gen(const std::string& str,unsigned char by_name,unsigned char global_op,unsigned char local_op)
+{
+    // values in the running function use local slots
+    // values of outer functions are found by name in closure,so does "me" given by callh
+    // others are in global slots if they are defined in global scope
+    opcode op;
+    if(!local.empty() && local.back().count(str))
+    {
+        // a local slot is empty before its definition runs,
+        // so capture the outer value with the same name for the by-name fallback
+        if(outer_symbol(str))
+            add_symbol(capture.back(),str);
+        op.op=local_op;
+        op.index=local.back()[str];
+        exec_code.push_back(op);
+        return;
+    }
+    bool outer=outer_symbol(str);
+    if(!outer && global.count(str))
+    {
+        op.op=global_op;
+        op.index=global[str];
+        exec_code.push_back(op);
+        return;
+    }
+    if(outer && !local.empty())
+        add_symbol(capture.back(),str);
+    regist_string(str);
+    op.op=by_name;
+    op.index=string_table[str];
+    exec_code.push_back(op);
+    return;
+}
+
+bool nasal_codegen::reg_operand_gen(nasal_ast& ast,reg_operand& opr)
+{
+    // numbers and values in local/global slots can be operands,others need the value stack
+    if(ast.get_type()==ast_number)
+    {
+        regist_number(ast.get_num());
+        opr.type=reg_number;
+        opr.index=number_table[ast.get_num()];
+        return true;
+    }
+    nasal_ast* id=&ast;
+    if(ast.get_type()==ast_call && ast.get_children().size()==1)
+        id=&ast.get_children()[0];
+    if(id->get_type()!=ast_identifier)
+        return false;
+    const std::string& str=id->get_str();
+    for(int i=0;builtin_func_table[i].func_pointer;++i)
+        if(builtin_func_table[i].func_name==str)
+            return false;
+    if(!local.empty() && local.back().count(str))
+    {
+        if(outer_symbol(str))
+            add_symbol(capture.back(),str);
+        opr.type=reg_local;
+        opr.index=local.back()[str];
+        return true;
+    }
+    // same as id_gen,values of outer functions are found by name
+    if(outer_symbol(str) || !global.count(str))
+        return false;
+    opr.type=reg_global;
+    opr.index=global[str];
+    return true;
+}
+
+bool nasal_codegen::reg_value_gen(nasal_ast& ast,opreg& reg,unsigned char& op)
+{
+    // a or a+b,a-b,a*b,a/b
+    if(reg_operand_gen(ast,reg.a))
+    {
+        op=op_rmov;
+        return true;
+    }
+    switch(ast.get_type())
+    {
+        case ast_add: op=op_radd;break;
+        case ast_sub: op=op_rsub;break;
+        case ast_mult:op=op_rmul;break;
+        case ast_div: op=op_rdiv;break;
+        default:return false;
+    }
+    return reg_operand_gen(ast.get_children()[0],reg.a) && reg_operand_gen(ast.get_children()[1],reg.b);
+}
+
+void nasal_codegen::reg_code_gen(unsigned char op_type,opreg& reg)
+{
+    opcode op;
+    op.op=op_type;
+    op.index=reg_table.size();
+    reg_table.push_back(reg);
+    exec_code.push_back(op);
+    return;
+}
+
+bool nasal_codegen::reg_gen(nasal_ast& ast)
+{
+    // statement id=a,id=a+b or id+=a,value of the assignment is not used
+    if(!reg_mode)
+        return false;
+    opreg reg;
+    unsigned char op;
+    switch(ast.get_type())
+    {
+        case ast_equal:     op=op_rmov;break;
+        case ast_add_equal: op=op_radd;break;
+        case ast_sub_equal: op=op_rsub;break;
+        case ast_mult_equal:op=op_rmul;break;
+        case ast_div_equal: op=op_rdiv;break;
+        default:return false;
+    }
+    if(!reg_operand_gen(ast.get_children()[0],reg.dst) || reg.dst.type==reg_number)
+        return false;
+    if(op==op_rmov)
+    {
+        if(!reg_value_gen(ast.get_children()[1],reg,op))
+            return false;
+    }
+    else
+    {
+        reg.a=reg.dst;
+        if(!reg_operand_gen(ast.get_children()[1],reg.b))
+            return false;
+    }
+    reg_code_gen(op,reg);
+    return true;
+}
+
+bool nasal_codegen::reg_cond_gen(nasal_ast& ast)
+{
+    // condition a cmp b jumps without the value stack,place to jump is set by set_jump
+    if(!reg_mode)
+        return false;
+    opreg reg;
+    switch(ast.get_type())
+    {
+        case ast_cmp_equal:     reg.cmp=op_eq;  break;
+        case ast_cmp_not_equal: reg.cmp=op_neq; break;
+        case ast_less_than:     reg.cmp=op_less;break;
+        case ast_less_equal:    reg.cmp=op_leq; break;
+        case ast_greater_than:  reg.cmp=op_grt; break;
+        case ast_greater_equal: reg.cmp=op_geq; break;
+        default:return false;
+    }
+    if(!reg_operand_gen(ast.get_children()[0],reg.a) || !reg_operand_gen(ast.get_children()[1],reg.b))
+        return false;
+    reg_code_gen(op_rjf,reg);
+    return true;
+}
+
+void nasal_codegen::set_jump(int ptr,int place)
+{
+    if(exec_code[ptr].op==op_rjf)
+        reg_table[exec_code[ptr].index].dst.index=place;
+    else
+        exec_code[ptr].index=place;
+    return;
+}
+
+void nasal_codegen::super_gen()
+{
+    // sequences are matched on opcodes before fusing,so a sequence may begin inside another one
+    std::vector<unsigned char> ops;
+    for(int i=0;i<(int)exec_code.size();++i)
+        ops.push_back(exec_code[i].op);
+    for(int i=0;i<(int)ops.size();++i)
+        for(int j=0;super_table[j].size;++j)
+        {
+            int size=super_table[j].size;
+            int k=0;
+            while(k<size && i+k<(int)ops.size() && ops[i+k]==super_table[j].seq[k])
+                ++k;
+            if(k==size)
+            {
+                exec_code[i].op=super_table[j].super;
+                break;
+            }
+        }
+    return;
+}
+
 void nasal_codegen::pop_gen()
 {
     opcode op;
@@ -292,7 +676,10 @@ void nasal_codegen::function_gen(nasal_ast& ast)
     opcode op;
     op.op=op_newfunc;
     op.index=0;
+    int newfunc_ptr=exec_code.size();
     exec_code.push_back(op);
+    // parameters use the first slots in order,so callf puts arguments without searching names
+    std::vector<std::string> names;
 
     nasal_ast& ref_arg=ast.get_children()[0];
     int arg_size=ref_arg.get_children().size();
@@ -303,6 +690,7 @@ void nasal_codegen::function_gen(nasal_ast& ast)
         {
             std::string str=tmp.get_str();
             regist_string(str);
+            names.push_back(str);
             opcode tmp;
             tmp.op=op_para;
             tmp.index=string_table[str];
@@ -313,6 +701,7 @@ void nasal_codegen::function_gen(nasal_ast& ast)
             calculation_gen(tmp.get_children()[1]);
             std::string str=tmp.get_children()[0].get_str();
             regist_string(str);
+            names.push_back(str);
             opcode tmp;
             tmp.op=op_defpara;
             tmp.index=string_table[str];
@@ -322,6 +711,7 @@ void nasal_codegen::function_gen(nasal_ast& ast)
         {
             std::string str=tmp.get_str();
             regist_string(str);
+            names.push_back(str);
             opcode tmp;
             tmp.op=op_dynpara;
             tmp.index=string_table[str];
@@ -337,7 +727,11 @@ void nasal_codegen::function_gen(nasal_ast& ast)
     int ptr=exec_code.size();
     exec_code.push_back(op);
 
+    // default values are calculated in outer scope,so scope of this function begins here
     nasal_ast& block=ast.get_children()[1];
+    find_symbol(block,names);
+    int scope_index=new_scope(names);
+    exec_code[newfunc_ptr].index=scope_index;
     block_gen(block);
     if(!block.get_children().size() || block.get_children().back().get_type()!=ast_return)
     {
@@ -348,6 +742,18 @@ void nasal_codegen::function_gen(nasal_ast& ast)
         op.index=0;
         exec_code.push_back(op);
     }
+    // functions made in global scope have nothing to capture
+    // values captured by inner functions are captured by this function too if they are not its own
+    std::vector<std::string> captured=capture.back();
+    capture.pop_back();
+    local.pop_back();
+    if(!local.empty())
+    {
+        capture_table[scope_index]=captured;
+        for(int i=0;i<(int)captured.size();++i)
+            if(!local.back().count(captured[i]) || outer_symbol(captured[i]))
+                add_symbol(capture.back(),captured[i]);
+    }
 
     exec_code[ptr].index=exec_code.size();
     return;
@@ -374,18 +780,18 @@ void nasal_codegen::call_gen(nasal_ast& ast)
 
 void nasal_codegen::call_id(nasal_ast& ast)
 {
-    opcode op;
-    op.op=op_call;
     std::string str=ast.get_str();
     for(int i=0;builtin_func_table[i].func_pointer;++i)
         if(builtin_func_table[i].func_name==str)
         {
+            opcode op;
             op.op=op_builtincall;
-            break;
+            regist_string(str);
+            op.index=string_table[str];
+            exec_code.push_back(op);
+            return;
         }
-    regist_string(str);
-    op.index=string_table[str];
-    exec_code.push_back(op);
+    id_gen(str,op_call,op_callg,op_calll);
     return;
 }
 
@@ -501,29 +907,38 @@ void nasal_codegen::call_func(nasal_ast& ast)
 void nasal_codegen::mem_call(nasal_ast& ast)
 {
     if(ast.get_type()==ast_identifier)
+    {
         mem_call_id(ast);
-    else
-        mem_call_id(ast.get_children()[0]);
+        return;
+    }
     int child_size=ast.get_children().size();
-    for(int i=1;i<child_size;++i)
+    if(child_size==1)
+    {
+        mem_call_id(ast.get_children()[0]);
+        return;
+    }
+    // values before the last call are got by normal calls
+    // only the last call gets the memory space
+    id_gen(ast.get_children()[0].get_str(),op_call,op_callg,op_calll);
+    for(int i=1;i<child_size-1;++i)
     {
         nasal_ast& tmp=ast.get_children()[i];
         if(tmp.get_type()==ast_call_hash)
-            mem_call_hash(tmp);
+            call_hash(tmp);
         else if(tmp.get_type()==ast_call_vec)
-            mem_call_vec(tmp);
+            call_vec(tmp);
     }
+    nasal_ast& tmp=ast.get_children()[child_size-1];
+    if(tmp.get_type()==ast_call_hash)
+        mem_call_hash(tmp);
+    else if(tmp.get_type()==ast_call_vec)
+        mem_call_vec(tmp);
     return;
 }
 
 void nasal_codegen::mem_call_id(nasal_ast& ast)
 {
-    std::string str=ast.get_str();
-    regist_string(str);
-    opcode op;
-    op.op=op_mcall;
-    op.index=string_table[str];
-    exec_code.push_back(op);
+    id_gen(ast.get_str(),op_mcall,op_mcallg,op_mcalll);
     return;
 }
 
@@ -550,12 +965,19 @@ void nasal_codegen::mem_call_hash(nasal_ast& ast)
 
 void nasal_codegen::single_def(nasal_ast& ast)
 {
-    calculation_gen(ast.get_children()[1]);
     opcode op;
-    op.op=op_load;
     std::string str=ast.get_children()[0].get_str();
-    regist_string(str);
-    op.index=string_table[str];
+    opreg reg;
+    if(reg_mode && reg_value_gen(ast.get_children()[1],reg,op.op))
+    {
+        reg.dst.type=local.empty()? reg_new_global:reg_new_local;
+        reg.dst.index=local.empty()? global[str]:local.back()[str];
+        reg_code_gen(op.op,reg);
+        return;
+    }
+    calculation_gen(ast.get_children()[1]);
+    op.op=local.empty()? op_loadg:op_loadl;
+    op.index=local.empty()? global[str]:local.back()[str];
     exec_code.push_back(op);
     return;
 }
@@ -568,10 +990,9 @@ void nasal_codegen::multi_def(nasal_ast& ast)
         {
             calculation_gen(ast.get_children()[1].get_children()[i]);
             opcode op;
-            op.op=op_load;
             std::string str=ast.get_children()[0].get_children()[i].get_str();
-            regist_string(str);
-            op.index=string_table[str];
+            op.op=local.empty()? op_loadg:op_loadl;
+            op.index=local.empty()? global[str]:local.back()[str];
             exec_code.push_back(op);
         }
     }
@@ -584,10 +1005,9 @@ void nasal_codegen::multi_def(nasal_ast& ast)
             op.op=op_callvi;
             op.index=i;
             exec_code.push_back(op);
-            op.op=op_load;
             std::string str=ast.get_children()[0].get_children()[i].get_str();
-            regist_string(str);
-            op.index=string_table[str];
+            op.op=local.empty()? op_loadg:op_loadl;
+            op.index=local.empty()? global[str]:local.back()[str];
             exec_code.push_back(op);
         }
     }
@@ -647,19 +1067,24 @@ void nasal_codegen::conditional_gen(nasal_ast& ast)
         nasal_ast& tmp=ast.get_children()[i];
         if(tmp.get_type()==ast_if || tmp.get_type()==ast_elsif)
         {
-            calculation_gen(tmp.get_children()[0]);
-            op.op=op_jmpfalse;
             int ptr=exec_code.size();
-            exec_code.push_back(op);
-
-            pop_gen();
+            bool reg=reg_cond_gen(tmp.get_children()[0]);
+            if(!reg)
+            {
+                calculation_gen(tmp.get_children()[0]);
+                op.op=op_jmpfalse;
+                ptr=exec_code.size();
+                exec_code.push_back(op);
+                pop_gen();
+            }
             block_gen(tmp.get_children()[1]);
 
             op.op=op_jmp;
             jmp_label.push_back(exec_code.size());
             exec_code.push_back(op);
-            exec_code[ptr].index=exec_code.size();
-            pop_gen();
+            set_jump(ptr,exec_code.size());
+            if(!reg)
+                pop_gen();
         }
         else
         {
@@ -699,18 +1124,25 @@ void nasal_codegen::while_gen(nasal_ast& ast)
 {
     opcode op;
     int loop_ptr=exec_code.size();
-    calculation_gen(ast.get_children()[0]);
-    op.op=op_jmpfalse;
     int condition_ptr=exec_code.size();
-    exec_code.push_back(op);
-    pop_gen();
+    bool reg=reg_cond_gen(ast.get_children()[0]);
+    if(!reg)
+    {
+        calculation_gen(ast.get_children()[0]);
+        op.op=op_jmpfalse;
+        condition_ptr=exec_code.size();
+        exec_code.push_back(op);
+        pop_gen();
+    }
     block_gen(ast.get_children()[1]);
     op.op=op_jmp;
     op.index=loop_ptr;
+    int continue_place=exec_code.size();
     exec_code.push_back(op);
-    exec_code[condition_ptr].index=exec_code.size();
-    pop_gen();
-    load_continue_break(exec_code.size()-2,exec_code.size());
+    set_jump(condition_ptr,exec_code.size());
+    if(!reg)
+        pop_gen();
+    load_continue_break(continue_place,exec_code.size());
     return;
 }
 
@@ -723,27 +1155,39 @@ void nasal_codegen::for_gen(nasal_ast& ast)
         case ast_definition:definition_gen(ast.get_children()[0]);break;
         case ast_multi_assign:multi_assignment_gen(ast.get_children()[0]);break;
         case ast_nil:case ast_number:case ast_string:case ast_function:break;
+        case ast_equal:case ast_add_equal:case ast_sub_equal:case ast_mult_equal:case ast_div_equal:
+            if(!reg_gen(ast.get_children()[0]))
+            {
+                calculation_gen(ast.get_children()[0]);
+                pop_gen();
+            }
+            break;
         case ast_vector:case ast_hash:
         case ast_call:
-        case ast_equal:case ast_add_equal:case ast_sub_equal:case ast_mult_equal:case ast_div_equal:case ast_link_equal:
+        case ast_link_equal:
         case ast_unary_sub:case ast_unary_not:
         case ast_add:case ast_sub:case ast_mult:case ast_div:case ast_link:
         case ast_cmp_equal:case ast_cmp_not_equal:case ast_less_equal:case ast_less_than:case ast_greater_equal:case ast_greater_than:
         case ast_trinocular:calculation_gen(ast.get_children()[0]);pop_gen();break;
     }
     int jmp_place=exec_code.size();
-    if(ast.get_children()[1].get_type()==ast_null)
+    int label_exit=exec_code.size();
+    bool reg=reg_cond_gen(ast.get_children()[1]);
+    if(!reg)
     {
-        op.op=op_pushone;
-        op.index=0;
+        if(ast.get_children()[1].get_type()==ast_null)
+        {
+            op.op=op_pushone;
+            op.index=0;
+            exec_code.push_back(op);
+        }
+        else
+            calculation_gen(ast.get_children()[1]);
+        op.op=op_jmpfalse;
+        label_exit=exec_code.size();
         exec_code.push_back(op);
+        pop_gen();
     }
-    else
-        calculation_gen(ast.get_children()[1]);
-    op.op=op_jmpfalse;
-    int label_exit=exec_code.size();
-    exec_code.push_back(op);
-    pop_gen();
     block_gen(ast.get_children()[3]);
     int continue_place=exec_code.size();
     switch(ast.get_children()[2].get_type())
@@ -752,9 +1196,16 @@ void nasal_codegen::for_gen(nasal_ast& ast)
         case ast_definition:definition_gen(ast.get_children()[2]);break;
         case ast_multi_assign:multi_assignment_gen(ast.get_children()[2]);break;
         case ast_nil:case ast_number:case ast_string:case ast_function:break;
+        case ast_equal:case ast_add_equal:case ast_sub_equal:case ast_mult_equal:case ast_div_equal:
+            if(!reg_gen(ast.get_children()[2]))
+            {
+                calculation_gen(ast.get_children()[2]);
+                pop_gen();
+            }
+            break;
         case ast_vector:case ast_hash:
         case ast_call:
-        case ast_equal:case ast_add_equal:case ast_sub_equal:case ast_mult_equal:case ast_div_equal:case ast_link_equal:
+        case ast_link_equal:
         case ast_unary_sub:case ast_unary_not:
         case ast_add:case ast_sub:case ast_mult:case ast_div:case ast_link:
         case ast_cmp_equal:case ast_cmp_not_equal:case ast_less_equal:case ast_less_than:case ast_greater_equal:case ast_greater_than:
@@ -763,8 +1214,9 @@ void nasal_codegen::for_gen(nasal_ast& ast)
     op.op=op_jmp;
     op.index=jmp_place;
     exec_code.push_back(op);
-    exec_code[label_exit].index=exec_code.size();
-    pop_gen();
+    set_jump(label_exit,exec_code.size());
+    if(!reg)
+        pop_gen();
     load_continue_break(continue_place,exec_code.size());
     return;
 }
@@ -783,10 +1235,9 @@ void nasal_codegen::forindex_gen(nasal_ast& ast)
     exec_code.push_back(op);
     if(ast.get_children()[0].get_type()==ast_new_iter)
     {
-        op.op=op_load;
         std::string str=ast.get_children()[0].get_children()[0].get_str();
-        regist_string(str);
-        op.index=string_table[str];
+        op.op=local.empty()? op_loadg:op_loadl;
+        op.index=local.empty()? global[str]:local.back()[str];
         exec_code.push_back(op);
     }
     else
@@ -819,10 +1270,9 @@ void nasal_codegen::foreach_gen(nasal_ast& ast)
     exec_code.push_back(op);
     if(ast.get_children()[0].get_type()==ast_new_iter)
     {
-        op.op=op_load;
         std::string str=ast.get_children()[0].get_children()[0].get_str();
-        regist_string(str);
-        op.index=string_table[str];
+        op.op=local.empty()? op_loadg:op_loadl;
+        op.index=local.empty()? global[str]:local.back()[str];
         exec_code.push_back(op);
     }
     else
@@ -1091,15 +1541,21 @@ void nasal_codegen::block_gen(nasal_ast& ast)
             case ast_for:
             case ast_forindex:
             case ast_foreach:loop_gen(tmp);break;
-            case ast_identifier:
-            case ast_vector:
-            case ast_hash:
-            case ast_call:
             case ast_equal:
             case ast_add_equal:
             case ast_sub_equal:
             case ast_mult_equal:
             case ast_div_equal:
+                if(!reg_gen(tmp))
+                {
+                    calculation_gen(tmp);
+                    pop_gen();
+                }
+                break;
+            case ast_identifier:
+            case ast_vector:
+            case ast_hash:
+            case ast_call:
             case ast_link_equal:
             case ast_unary_sub:
             case ast_unary_not:
@@ -1141,6 +1597,15 @@ void nasal_codegen::main_progress(nasal_ast& ast)
     number_table.clear();
     string_table.clear();
     exec_code.clear();
+    reg_table.clear();
+    symbol_table.clear();
+    capture_table.clear();
+    global.clear();
+    local.clear();
+    capture.clear();
+    std::vector<std::string> names;
+    find_symbol(ast,names);
+    new_scope(names);
 
     int size=ast.get_children().size();
     for(int i=0;i<size;++i)
@@ -1160,15 +1625,21 @@ void nasal_codegen::main_progress(nasal_ast& ast)
             case ast_for:
             case ast_forindex:
             case ast_foreach:loop_gen(tmp);break;
-            case ast_identifier:
-            case ast_vector:
-            case ast_hash:
-            case ast_call:
             case ast_equal:
             case ast_add_equal:
             case ast_sub_equal:
             case ast_mult_equal:
             case ast_div_equal:
+                if(!reg_gen(tmp))
+                {
+                    calculation_gen(tmp);
+                    pop_gen();
+                }
+                break;
+            case ast_identifier:
+            case ast_vector:
+            case ast_hash:
+            case ast_call:
             case ast_link_equal:
             case ast_unary_sub:
             case ast_unary_not:
@@ -1189,9 +1660,10 @@ void nasal_codegen::main_progress(nasal_ast& ast)
         }
     }
     opcode op;
-    op.op=op_nop;
+    op.op=op_exit;
     op.index=0;
     exec_code.push_back(op);
+    super_gen();
 
     number_result_table.resize(number_table.size());
     string_result_table.resize(string_table.size());
@@ -1244,13 +1716,67 @@ void nasal_codegen::print_op(int index)
         case op_mcallh:
         case op_para:
         case op_defpara:
-        case op_dynpara:
-        case op_load:std::cout<<'('<<string_result_table[exec_code[index].index]<<')';break;
+        case op_dynpara:std::cout<<'('<<string_result_table[exec_code[index].index]<<')';break;
+        case op_loadg:
+        case op_callg:
+        case op_mcallg:std::cout<<'('<<symbol_table[0][exec_code[index].index]<<')';break;
+        case op_rmov:
+        case op_radd:
+        case op_rsub:
+        case op_rmul:
+        case op_rdiv:
+        case op_rjf:print_reg(reg_table[exec_code[index].index],exec_code[index].op);break;
     }
     std::cout<<'\n';
     return;
 }
 
+void nasal_codegen::print_reg_operand(reg_operand& opr)
+{
+    // local slots are printed as l<index>
+    switch(opr.type)
+    {
+        case reg_number:std::cout<<number_result_table[opr.index];break;
+        case reg_local:
+        case reg_new_local:std::cout<<'l'<<opr.index;break;
+        case reg_global:
+        case reg_new_global:std::cout<<symbol_table[0][opr.index];break;
+    }
+    return;
+}
+
+void nasal_codegen::print_reg(opreg& reg,unsigned char op_type)
+{
+    // (dst,a,b) or (a cmp b,place to jump)
+    std::cout<<'(';
+    if(op_type==op_rjf)
+    {
+        print_reg_operand(reg.a);
+        switch(reg.cmp)
+        {
+            case op_eq:  std::cout<<"==";break;
+            case op_neq: std::cout<<"!=";break;
+            case op_less:std::cout<<"<"; break;
+            case op_leq: std::cout<<"<=";break;
+            case op_grt: std::cout<<">"; break;
+            case op_geq: std::cout<<">=";break;
+        }
+        print_reg_operand(reg.b);
+        std::cout<<",0x"<<std::hex<<reg.dst.index<<std::dec<<')';
+        return;
+    }
+    print_reg_operand(reg.dst);
+    std::cout<<',';
+    print_reg_operand(reg.a);
+    if(op_type!=op_rmov)
+    {
+        std::cout<<',';
+        print_reg_operand(reg.b);
+    }
+    std::cout<<')';
+    return;
+}
+
 void nasal_codegen::print_byte_code()
 {
     for(int i=0;i<number_result_table.size();++i)
@@ -1278,4 +1804,19 @@ std::vector<opcode>& nasal_codegen::get_exec_code()
     return exec_code;
 }
 
+std::vector<std::vector<std::string> >& nasal_codegen::get_symbol_table()
+{
+    return symbol_table;
+}
+
+std::vector<std::vector<std::string> >& nasal_codegen::get_capture_table()
+{
+    return capture_table;
+}
+
+std::vector<opreg>& nasal_codegen::get_reg_table()
+{
+    return reg_table;
+}
+
 #endif
\ No newline at end of file
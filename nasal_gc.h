@@ -11,56 +11,211 @@ enum runtime_scalar_type
     vm_vector,
     vm_hash
 };
+enum gc_phase_type
+{
+    gc_phase_idle=0,
+    gc_phase_mark,
+    gc_phase_sweep
+};
+enum gc_limit_type
+{
+    gc_limit_ok=0,
+    gc_limit_recheck,  // payloads may have grown without allocation,major collection in steps measures them again
+    gc_limit_collect,  // heap may be over the limit,full collection is needed
+    gc_limit_exceeded  // heap is still over the limit after full collection
+};
+// allocations in tracing mode with byte limit set between two exact measurements of heap bytes
+const int gc_limit_interval=1<<20;
+// each major gc step does at least gc_step_ratio units of work for every unit moved into old space since the last step
+const int gc_step_ratio=8;
+// integers in [gc_small_int_min,gc_small_int_max) are boxed once in tracing mode
+const int gc_small_int_min=-128;
+const int gc_small_int_max=1024;
 /*
-nasal_number: basic type(double)
-nasal_string: basic type(std::string)
-nasal_vector: elems[i] -> address in memory -> value address in gc
-nasal_hash:   elems[key] -> address in memory -> value address in gc
+nasal_number: basic type(double),stored in nasal_scalar directly without extra allocation
+nasal_string: std::string in nasal_string_buffer,each string uses a prefix of its buffer
+              strings made by linking share the buffer with the left string
+nasal_vector: elems[i] -> value address in gc
+nasal_hash:   vals[slot] -> value address in gc,shape(nasal_shape) key -> slot
 nasal_function: closure -> value address in gc(type: nasal_closure)
-nasal_closure: std::list<std::map<std::string,int>> -> std::map<std::string,int> -> (int) -> address in memory -> value address in gc
+nasal_closure: std::list<nasal_scope> -> slots[index] -> value address in gc,names of slots are in the table of scope
+get_mem_address returns a pointer to the slot that stores value address,
+this pointer is used to change the value and will be invalid after the container changes its size
 */
 
 class nasal_virtual_machine;
+class nasal_hash;
+
+struct nasal_string_buffer
+{
+    std::string str;
+    int share;      // number of strings using this buffer
+    nasal_string_buffer()
+    {
+        share=1;
+        return;
+    }
+};
+
+/*
+nasal_vector_buffer: storage of vectors,a slice of vector shares the buffer and uses a range of it
+buffer is copied before the vector that shares it is changed
+slices are only made by nasal_bytecode_vm,because elements out of range are not referenced by reference counting
+*/
+struct nasal_vector_buffer
+{
+    std::vector<int>    elems;
+    std::vector<double> nums;
+    int share;      // number of vectors using this buffer
+    nasal_vector_buffer()
+    {
+        share=1;
+        return;
+    }
+};
 
 class nasal_vector
 {
+    friend class nasal_virtual_machine;
+    friend class nasal_hash;
 private:
-    // this int points to the space in nasal_vm::memory_manager_memory
     nasal_virtual_machine& vm;
-    std::vector<int> elems;
+    // elements are buf->elems[begin,begin+length),they point to the space in nasal_vm::garbage_collector_memory
+    // packed vector stores numbers in buf->nums[begin,begin+length) and uses no elems,
+    // it changes to the general form when a value that is not number is stored
+    nasal_vector_buffer* buf;
+    int begin;
+    int length;
+    bool packed;
+    // this vector has been used as parents,changing it makes cached members of parents invalid
+    bool proto;
+    void own();                 // buffer only used by this vector and begin is 0 after this
 public:
     nasal_vector(nasal_virtual_machine&);
     ~nasal_vector();
+    void clear();
     void add_elem(int);
     int  del_elem();
     int  size();
-    int  get_value_address(int);
-    int  get_mem_address(int);
+    int  get_value_address(int);// number in packed vector is boxed into a new value
+    int* get_mem_address(int);  // packed vector is unpacked
     void print();
+    // only used in tracing mode,because boxed numbers are not referenced by reference counting
+    void set_packed();          // empty vector begins to store numbers directly
+    bool is_packed();
+    void unpack();
+    bool check_index(int);
+    void add_number(double);
+    double get_number(int);     // packed vector only,index must be checked
+    void set_number(int,double);
+    void set_slice(nasal_vector&,int,int);// empty vector shares [begin,end) of another vector
+};
+
+/*
+nasal_hashmap: open addressing hash table with linear probing,maps key to its position
+keys and hashes of keys are stored in insertion order,index stores their positions
+erased keys have hash 0 and are removed by compact()
+*/
+class nasal_hashmap
+{
+private:
+    std::vector<int> index;      // -1 means empty slot,size is power of 2
+    int alive;
+    void rebuild();
+public:
+    std::vector<std::string>  keys;
+    std::vector<unsigned int> hashes;
+    nasal_hashmap();
+    static unsigned int hash(const std::string&);
+    int  size() const;
+    int  slots() const;                          // size of index
+    int  find(const std::string&,unsigned int) const;// position of key,-1 if not found
+    int  insert(const std::string&,unsigned int);// key must not be in the table,returns its position
+    void erase(int);
+    void compact(std::vector<int>&);             // remove erased keys and elements of vector at the same positions
+    void clear();
+};
+
+/*
+nasal_shape: layout of hash,key -> slot of value
+hashes made by adding same keys in same order share one shape,so (shape,slot) can be cached
+shapes in the transition tree are owned by nasal_virtual_machine and never change until clear()
+a hash gets its own shape(dictionary mode) after deleting a key or having more than shape_max_keys keys,
+this shape is changed in place and must not be cached
+*/
+const int shape_max_keys=64;
+struct nasal_shape
+{
+    bool dict;
+    int  parents_slot;           // slot of "parents",-1 if not found
+    nasal_hashmap layout;
+    nasal_hashmap next_keys;     // transitions: key -> next shape
+    std::vector<nasal_shape*> next;
+    nasal_shape()
+    {
+        dict=false;
+        parents_slot=-1;
+        return;
+    }
+};
+
+/*
+nasal_parents_cache: members found in parents by one hash,the cache is made when the hash first looks up parents
+an entry is valid when shape_epoch of gc is not changed,and it is cleared when the hash itself changes its keys
+*/
+const int parents_cache_size=4;
+struct nasal_parents_cache
+{
+    unsigned int hash;           // hash of key
+    unsigned int epoch;
+    nasal_hash*  owner;          // NULL means empty
+    int owner_addr;
+    int slot;
 };
 
 class nasal_hash
 {
+    friend class nasal_virtual_machine;
 private:
-    // this int points to the space in nasal_vm::memory_manager_memory
     nasal_virtual_machine& vm;
-    std::map<std::string,int> elems;
+    nasal_shape* shape;
+    std::vector<int> vals;       // vals[slot] -> value address in gc
+    // this hash has been found in parents,changing it makes cached members of parents invalid
+    bool proto;
+    nasal_parents_cache* parents_cache;
+    void set_dict();
+    void clear_parents_cache();
+    nasal_hash* find_owner(const std::string&,unsigned int,int&,int&);
+    nasal_hash* resolve(const std::string&,unsigned int,int&,int&);// find_owner using parents_cache
 public:
     nasal_hash(nasal_virtual_machine&);
     ~nasal_hash();
-    void add_elem(std::string,int);
-    void del_elem(std::string);
+    void clear();
+    // functions with unsigned int use hash of key computed by caller
+    void add_elem(const std::string&,int);
+    void add_elem(const std::string&,unsigned int,int);
+    void del_elem(const std::string&);
     int  size();
-    int  get_special_para(std::string);
-    int  get_value_address(std::string);
-    int  get_mem_address(std::string);
-    bool check_contain(std::string);
+    int  get_special_para(const std::string&);
+    int  get_value_address(const std::string&);
+    int  get_value_address(const std::string&,unsigned int);
+    int* get_mem_address(const std::string&);
+    int* get_mem_address(const std::string&,unsigned int);
+    bool check_contain(const std::string&);
+    bool check_contain(const std::string&,unsigned int);
     int  get_keys();
     void print();
+    // used by inline caches
+    nasal_shape* get_shape();
+    nasal_hash*  get_owner(const std::string&,unsigned int,int&);// hash that has this key and slot of it,NULL if not found
+    nasal_hash*  get_first_parent();                            // hash in parents[0],NULL if not found
+    int  get_slot_value(int);
+    int* get_slot_mem(int);
 };
 
 class nasal_function
 {
+    friend class nasal_virtual_machine;
 private:
     // this int points to the space in nasal_vm::garbage_collector_memory
     nasal_virtual_machine& vm;
@@ -71,6 +226,7 @@ private:
     std::vector<std::string> para_name;
     std::string dynamic_para_name;
     std::vector<int> default_para_addr;
+    const nasal_hashmap* local_table;
 public:
     nasal_function(nasal_virtual_machine&);
     ~nasal_function();
@@ -81,155 +237,469 @@ public:
     std::string get_dynamic_para();
     std::vector<int>& get_default();
     void set_closure_addr(int);
+    void bind_closure_addr(int);
     int  get_closure_addr();
+    void set_local_table(const nasal_hashmap*);
+    const nasal_hashmap* get_local_table();
     void set_arguments(nasal_ast&);
     nasal_ast& get_arguments();
     void set_run_block(nasal_ast&);
     nasal_ast& get_run_block();
 };
 
+struct nasal_scope
+{
+    // slots of one scope,-1 means this value is not defined yet
+    // frames of one function share the table of names made by codegen
+    // scopes made at run time have no table and keep their own names
+    // position of a name in table or names is its slot
+    const nasal_hashmap* table;
+    nasal_hashmap names;
+    std::vector<int> slots;
+    nasal_scope(const nasal_hashmap*);
+    const std::string& get_name(int);
+    int find(const std::string&,unsigned int);
+};
+
 class nasal_closure
 {
+    friend class nasal_virtual_machine;
 private:
-    // int in std::map<std::string,int> points to the space in nasal_vm::memory_manager_memory
-    // and this memory_manager_memory space stores an address to garbage_collector_memory
-    // and this address points to an nasal_hash
+    // int in slots points to the space in nasal_vm::garbage_collector_memory
     nasal_virtual_machine& vm;
-    std::list<std::map<std::string,int> > elems;
+    std::list<nasal_scope> elems;
+    // changed when scopes or names change,so cached slots can be checked cheaply
+    unsigned int version;
 public:
     nasal_closure(nasal_virtual_machine&);
     ~nasal_closure();
-    void add_scope();
+    void add_scope(const nasal_hashmap* table=NULL,const int* values=NULL);
     void del_scope();
-    void add_new_value(std::string,int);
-    int  get_value_address(std::string);
-    int  get_mem_address(std::string);
+    void add_new_value(const std::string&,int);
+    int  get_value_address(const std::string&);
+    int* get_mem_address(const std::string&);
     void set_closure(nasal_closure&);
+    void set_local(int,int);
+    int  get_local(int);
+    int* get_local_mem(int);
+    const std::string& get_local_name(int);
+    unsigned int get_version();
+    nasal_scope* get_single_scope();
 };
 
 class nasal_scalar
 {
+    friend class nasal_virtual_machine;
 protected:
     int type;
-    void* scalar_ptr;
+    // length of string,string may be a prefix of its buffer
+    int str_len;
+    // number is stored in this union directly
+    // other types use ptr to find their real data
+    union
+    {
+        double num;
+        void*  ptr;
+    }value;
 public:
     nasal_scalar();
     ~nasal_scalar();
     void clear();
     void set_type(int,nasal_virtual_machine&);
     void set_number(double);
-    void set_string(std::string);
+    void set_string(const std::string&);
     int             get_type();
     double          get_number();
-    std::string     get_string();
+    const std::string& get_string();
     nasal_vector&   get_vector();
     nasal_hash&     get_hash();
     nasal_function& get_func();
     nasal_closure&  get_closure();
 };
 
+/*
+nasal_ref: value that stays in the value stack of nasal_bytecode_vm
+vm_nil and vm_number are stored in nasal_ref directly and never use gc,
+other types store their address in garbage_collector_memory,
+values are boxed into gc only when they are stored in vector/hash/closure
+*/
+struct nasal_ref
+{
+    int type;
+    union
+    {
+        double num;
+        int    addr;
+    }value;
+    nasal_ref()
+    {
+        type=vm_nil;
+        value.addr=-1;
+        return;
+    }
+    nasal_ref(double num)
+    {
+        type=vm_number;
+        value.num=num;
+        return;
+    }
+    nasal_ref(int value_type,int value_addr)
+    {
+        type=value_type;
+        value.addr=value_addr;
+        return;
+    }
+    bool in_gc()
+    {
+        return type!=vm_nil && type!=vm_number;
+    }
+};
+
+// heap statistics,counters are indexed by runtime_scalar_type
+// values moved from nursery to old space are not counted as allocations or frees
+struct nasal_gc_stat
+{
+    long long alloc_count[vm_hash+1];
+    long long free_count[vm_hash+1];
+    int    live_count[vm_hash+1];
+    long long live_bytes;    // estimated size of live values and their payloads
+    int    live_units;
+    int    peak_live_units;
+    int    heap_units;       // units in all slabs,heap never shrinks before clear()
+    int    free_list;
+    int    nursery_used;
+    int    nursery_size;
+    int    remembered;
+    int    pool_size;        // payloads kept in string/vector/hash pools
+    int    minor_count;
+    int    major_count;
+    double gc_time;          // seconds spent in collection steps and lazy freeing
+    double max_pause;        // longest pause of one safe point or one lazy freeing,in seconds
+    int    max_step_work;    // most units of work done by one major step
+    int    over_budget;      // major steps doing more work than gc step budget
+    long long parents_hit;   // lookups of members in parents done by nasal_parents_cache
+    long long parents_miss;
+    nasal_gc_stat()
+    {
+        for(int i=0;i<=vm_hash;++i)
+        {
+            alloc_count[i]=free_count[i]=0;
+            live_count[i]=0;
+        }
+        live_bytes=0;
+        live_units=peak_live_units=0;
+        heap_units=free_list=0;
+        nursery_used=nursery_size=remembered=pool_size=0;
+        minor_count=major_count=0;
+        gc_time=0;
+        max_pause=0;
+        max_step_work=over_budget=0;
+        parents_hit=parents_miss=0;
+        return;
+    }
+};
+
 class nasal_virtual_machine
 {
     struct gc_unit
     {
         bool collected;
+        bool marked;
+        bool remembered;
+        bool permanent;
         int ref_cnt;
+        unsigned int str_hash;   // hash of interned string,computed once in gc_intern
         nasal_scalar elem;
         gc_unit()
         {
             collected=true;
+            marked=false;
+            remembered=false;
+            permanent=false;
             ref_cnt=0;
+            str_hash=0;
             return;
         }
     };
 private:
+    // reference counting is used by default(nasal_runtime)
+    // tracing mode uses generational gc and reference counting is ignored(nasal_bytecode_vm)
+    // young values are allocated in nursery: garbage_collector_memory[0,nursery_size)
+    // minor collection moves alive young values into old space,major collection is mark-sweep of old space
+    bool tracing;
+    int nursery_size;
+    int nursery_top;
+    std::vector<int> nursery_forward;
+    std::vector<int> remembered_set;
+    std::vector<int> gc_scan_stack;
+    int gc_alloc_count;
+    int gc_threshold;
+    int minor_count;
+    int major_count;
+    std::vector<int> gc_mark_stack;
+    // major collection can be split into steps,each step does about gc_step_budget units of work
+    // budget is not a bound of pause time,a step does more work when
+    //     values are moved into old space during collection,each of them gives gc_step_ratio units more budget
+    //     old space has grown by another threshold since collection began or heap limit is reached,the rest is done at once
+    //     one value has many children,they are all pushed when it is scanned
+    // and each safe point does a whole minor collection and pushes all roots again out of the budget
+    // max_pause and max_step_work in nasal_gc_stat show what steps really cost
+    // in reference counting mode values with no reference are freed lazily in steps
+    // gc_step_budget is 0 by default,which means all the work is done at once
+    int gc_step_budget;
+    int gc_step_alloc; // units moved into old space during major collection since the last step
+    int idle_budget;   // work asked by gc_idle in tracing mode,done at the next safe point,0 means none
+    int gc_phase;
+    int sweep_cursor;
+    int sweep_alive;
+    std::vector<int> pending_free;
+    // heap limit of tracing mode,0 means no limit
+    // heap bytes are live units plus payloads counted by the last sweep and payloads allocated after it,
+    // payloads growing without allocation are measured by a major collection begun after gc_limit_interval allocations
+    int limit_units;
+    long long limit_bytes;
+    long long payload_bytes;
+    long long sweep_bytes;
+    int limit_state;
+    int limit_tick;
+    nasal_gc_stat stat;
+    // interpreter that owns this gc can give its roots to builtins by this function
+    void (*root_provider)(void*,std::vector<int>&);
+    void* root_provider_obj;
     nasal_scalar error_returned_value;
-    std::queue<int> garbage_collector_free_space;
+    // gc units are allocated in slabs,garbage_collector_memory stores pointers to units in slabs
+    // free spaces are used as stacks so the latest freed space is reused first
+    std::vector<gc_unit*> gc_slabs;
+    std::vector<int> garbage_collector_free_space;
     std::vector<gc_unit*> garbage_collector_memory;
-    std::queue<int> memory_manager_free_space;
-    std::vector<int> memory_manager_memory;
+    // payloads of freed strings/vectors/hashes are kept here and reused by next allocation
+    std::vector<nasal_string_buffer*> string_pool;
+    std::vector<nasal_vector*> vector_pool;
+    std::vector<nasal_hash*>   hash_pool;
+    // interned strings are immutable and permanent until clear(),equal strings share one address
+    std::map<std::string,int> string_intern;
+    // boxed nil and numbers given by gc_box_* in tracing mode are immutable and permanent until clear()
+    // small integers and pinned numbers share one address for each value,pinned numbers are found by bits of double
+    int pinned_nil;
+    std::vector<int> pinned_small;
+    std::vector<unsigned long long> pinned_bits;
+    std::vector<int> pinned_addr;
+    int pinned_count;
+    // transition tree of shapes,root is the shape of empty hash
+    // shape_epoch changes when parents or hashes in parents change,caches of inherited members check it
+    nasal_shape root_shape;
+    std::vector<nasal_shape*> shape_list;
+    unsigned int shape_epoch;
+    void gc_new_slab(int);
+    int  gc_new_unit();
+    int  gc_alloc_unit(int);
+    void scalar_alloc(nasal_scalar&,int);
+    void scalar_free(nasal_scalar&);
+    int  gc_mark_step(int);
+    int  gc_sweep_step(int);
+    int  gc_free_pending(int);
+    void gc_count_free(nasal_scalar&);
+    void gc_check_limit();
+    void gc_dump_edge(std::ofstream&,int,std::string);
+    long long scalar_bytes(nasal_scalar&);
+    int  gc_new_pinned(int,double);
+    int  gc_pinned_pos(unsigned long long);
 public:
     nasal_virtual_machine();
     ~nasal_virtual_machine();
     void clear();
     void debug();
+    void set_tracing(bool);      // switch between reference counting and generational gc
+    void set_nursery_size(int);  // size of young generation,used after next clear()
+    bool gc_need_collect();      // minor collection should be done at the next safe point
+    void set_gc_step_budget(int);// work of each gc step,0 means stop-the-world,steps may do more(see gc_step_budget)
+    void set_heap_limit(int,long long);// limit of live units and bytes in tracing mode,0 means no limit
+    bool gc_out_of_memory();     // heap is over the limit even after full collection
+    bool gc_need_major();        // mark-sweep of old space should begin or is in progress
+    void gc_write_barrier(int);  // value is going to be changed and may point to young values
+    int  gc_promote(int);        // move young value to old space and return the new address
+    void gc_minor();             // promote values reachable from remembered set and free nursery
+    void gc_mark(int);           // mark root value,major collection begins if it is not in progress
+    void gc_major_step(int budget=-1);// mark and sweep old space after roots are marked,-1 means gc step budget
+    void gc_idle(int);           // ask for n units of gc work,reference counting mode frees pending values at once
+    int  gc_take_idle();         // budget asked by gc_idle for this safe point,-1 if nothing is asked
+    void gc_count_pause(clock_t);// pause of a safe point began at this time has just finished
+    int  gc_minor_count();
+    int  gc_major_count();
+    nasal_gc_stat gc_stat();     // counters are reset by clear()
+    void gc_stat_print();
+    bool gc_dump(std::string,std::vector<int>&);// write heap snapshot with given roots to file
+    void set_root_provider(void (*)(void*,std::vector<int>&),void*);
+    void gc_roots(std::vector<int>&);// get roots from root provider,nothing if it is not set
     int  gc_alloc(int);          // garbage collector gives a new space
+    int  gc_link(int,const std::string&);// new string of string value linked with another string
+    int  gc_intern(const std::string&);// get address of the interned string,it must not be changed by set_string
+    unsigned int gc_string_hash(int);// hash of string value used as hash key,interned strings are not hashed again
+    void gc_pin_number(double);  // number that is boxed often(constants of bytecode) shares one address in tracing mode
+    int  gc_box_nil();           // address of boxed nil,it must not be changed
+    int  gc_box_number(double);  // address of boxed number,it must not be changed by set_number
+    nasal_shape* gc_root_shape();
+    nasal_shape* gc_shape_next(nasal_shape*,const std::string&,unsigned int);// shape after adding this key
+    void gc_shape_changed();
+    unsigned int gc_shape_epoch();
+    void gc_count_parents_cache(bool);// count hit or miss of nasal_parents_cache
     nasal_scalar& gc_get(int);   // get scalar that stored in gc
     void add_reference(int);
     void del_reference(int);
-    int  mem_alloc(int);         // memory gives a new space
-    void mem_free(int);          // give space back to memory
-    void mem_change(int,int);    // change value in memory space
-    int  mem_get(int);           // get value in memory space
 };
 
 /*functions of nasal_vector*/
 nasal_vector::nasal_vector(nasal_virtual_machine& nvm):vm(nvm)
 {
+    buf=new nasal_vector_buffer;
+    begin=length=0;
+    packed=false;
+    proto=false;
     return;
 }
 nasal_vector::~nasal_vector()
 {
-    int size=elems.size();
+    if(--buf->share)
+        return;
+    int size=buf->elems.size();
     for(int i=0;i<size;++i)
-        vm.mem_free(elems[i]);
-    elems.clear();
+        vm.del_reference(buf->elems[i]);
+    delete buf;
+    return;
+}
+void nasal_vector::clear()
+{
+    if(buf->share>1)
+    {
+        --buf->share;
+        buf=new nasal_vector_buffer;
+    }
+    else
+    {
+        int size=buf->elems.size();
+        for(int i=0;i<size;++i)
+            vm.del_reference(buf->elems[i]);
+        buf->elems.clear();
+        buf->nums.clear();
+    }
+    begin=length=0;
+    packed=false;
+    proto=false;
+    return;
+}
+void nasal_vector::own()
+{
+    if(buf->share==1)
+    {
+        // other vectors using this buffer are freed,elements out of range are not used by anyone
+        if(packed && (begin || length!=(int)buf->nums.size()))
+        {
+            buf->nums.resize(begin+length);
+            buf->nums.erase(buf->nums.begin(),buf->nums.begin()+begin);
+        }
+        else if(!packed && (begin || length!=(int)buf->elems.size()))
+        {
+            buf->elems.resize(begin+length);
+            buf->elems.erase(buf->elems.begin(),buf->elems.begin()+begin);
+        }
+        begin=0;
+        return;
+    }
+    nasal_vector_buffer* tmp=new nasal_vector_buffer;
+    if(packed)
+        tmp->nums.assign(buf->nums.begin()+begin,buf->nums.begin()+begin+length);
+    else
+        tmp->elems.assign(buf->elems.begin()+begin,buf->elems.begin()+begin+length);
+    --buf->share;
+    buf=tmp;
+    begin=0;
     return;
 }
 void nasal_vector::add_elem(int value_address)
 {
-    int memory_address=vm.mem_alloc(value_address);
-    elems.push_back(memory_address);
+    own();
+    if(packed)
+    {
+        if(value_address>=0 && vm.gc_get(value_address).get_type()==vm_number)
+        {
+            buf->nums.push_back(vm.gc_get(value_address).get_number());
+            ++length;
+            return;
+        }
+        unpack();
+    }
+    buf->elems.push_back(value_address);
+    ++length;
+    if(proto)
+        vm.gc_shape_changed();
     return;
 }
 int nasal_vector::del_elem()
 {
     // pop back
-    if(!elems.size())
+    // the reference is moved to the returned value
+    if(!length)
         return -1;
-    int ret=vm.mem_get(elems.back());
-    vm.add_reference(ret);
-    vm.mem_free(elems.back());
-    elems.pop_back();
+    own();
+    --length;
+    if(packed)
+    {
+        int ret=vm.gc_box_number(buf->nums.back());
+        buf->nums.pop_back();
+        return ret;
+    }
+    int ret=buf->elems.back();
+    buf->elems.pop_back();
+    if(proto)
+        vm.gc_shape_changed();
     return ret;
 }
 int nasal_vector::size()
 {
-    return elems.size();
+    return length;
 }
 int nasal_vector::get_value_address(int index)
 {
-    int vec_size=elems.size();
-    int left_range=-vec_size;
-    int right_range=vec_size-1;
+    int left_range=-length;
+    int right_range=length-1;
     if(index<left_range || index>right_range)
     {
         std::cout<<">> [runtime] nasal_vector::get_value_address: index out of range: "<<index<<"\n";
         return -1;
     }
-    return vm.mem_get(elems[(index+vec_size)%vec_size]);
+    if(packed)
+    {
+        return vm.gc_box_number(buf->nums[begin+(index+length)%length]);
+    }
+    return buf->elems[begin+(index+length)%length];
 }
-int nasal_vector::get_mem_address(int index)
+int* nasal_vector::get_mem_address(int index)
 {
-    int vec_size=elems.size();
-    int left_range=-vec_size;
-    int right_range=vec_size-1;
+    int left_range=-length;
+    int right_range=length-1;
     if(index<left_range || index>right_range)
     {
         std::cout<<">> [runtime] nasal_vector::get_mem_address: index out of range: "<<index<<"\n";
-        return -1;
+        return NULL;
     }
-    return elems[(index+vec_size)%vec_size];
+    unpack();
+    if(proto)
+        vm.gc_shape_changed();
+    return &buf->elems[(index+length)%length];
 }
 void nasal_vector::print()
 {
-    int size=elems.size();
     std::cout<<"[";
-    if(!size)
+    if(!length)
         std::cout<<"]";
-    for(int i=0;i<size;++i)
+    for(int i=0;i<length;++i)
     {
-        nasal_scalar& tmp=vm.gc_get(vm.mem_get(elems[i]));
+        if(packed)
+        {
+            std::cout<<buf->nums[begin+i]<<",]"[i==length-1];
+            continue;
+        }
+        nasal_scalar& tmp=vm.gc_get(buf->elems[begin+i]);
         switch(tmp.get_type())
         {
             case vm_nil:std::cout<<"nil";break;
@@ -239,148 +709,432 @@ void nasal_vector::print()
             case vm_hash:tmp.get_hash().print();break;
             case vm_function:std::cout<<"func(...){...}";break;
         }
-        std::cout<<",]"[i==size-1];
+        std::cout<<",]"[i==length-1];
     }
     return;
 }
-
-/*functions of nasal_hash*/
-nasal_hash::nasal_hash(nasal_virtual_machine& nvm):vm(nvm)
+void nasal_vector::set_packed()
 {
+    if(!length)
+    {
+        own();
+        packed=true;
+    }
     return;
 }
-nasal_hash::~nasal_hash()
+bool nasal_vector::is_packed()
 {
-    for(std::map<std::string,int>::iterator iter=elems.begin();iter!=elems.end();++iter)
-        vm.mem_free(iter->second);
-    elems.clear();
+    return packed;
+}
+void nasal_vector::unpack()
+{
+    // caller should use write barrier of this vector,new numbers may be young values
+    own();
+    if(!packed)
+        return;
+    packed=false;
+    buf->elems.reserve(length);
+    for(int i=0;i<length;++i)
+        buf->elems.push_back(vm.gc_box_number(buf->nums[i]));
+    buf->nums.clear();
     return;
 }
-void nasal_hash::add_elem(std::string key,int value_address)
+bool nasal_vector::check_index(int index)
 {
-    if(elems.find(key)==elems.end())
+    return -length<=index && index<length;
+}
+void nasal_vector::add_number(double num)
+{
+    if(packed)
     {
-        int memory_address=vm.mem_alloc(value_address);
-        elems[key]=memory_address;
+        own();
+        buf->nums.push_back(num);
+        ++length;
+        return;
     }
+    add_elem(vm.gc_box_number(num));
+    return;
+}
+double nasal_vector::get_number(int index)
+{
+    return buf->nums[begin+(index+length)%length];
+}
+void nasal_vector::set_number(int index,double num)
+{
+    own();
+    buf->nums[(index+length)%length]=num;
     return;
 }
-void nasal_hash::del_elem(std::string key)
+void nasal_vector::set_slice(nasal_vector& vec,int left,int right)
 {
-    if(elems.find(key)!=elems.end())
+    if(length)
+        return;
+    if(--buf->share)
+        buf=vec.buf;
+    else
     {
-        vm.mem_free(elems[key]);
-        elems.erase(key);
+        delete buf;
+        buf=vec.buf;
     }
+    ++buf->share;
+    begin=vec.begin+left;
+    length=right-left;
+    packed=vec.packed;
     return;
 }
-int nasal_hash::size()
+
+/*functions of nasal_hashmap*/
+nasal_hashmap::nasal_hashmap()
 {
-    return elems.size();
+    alive=0;
+    return;
 }
-int nasal_hash::get_special_para(std::string key)
+unsigned int nasal_hashmap::hash(const std::string& key)
 {
-    if(elems.find(key)!=elems.end())
-        return vm.mem_get(elems[key]);
-    return -1;
+    // FNV-1a,0 is kept for erased keys
+    unsigned int h=2166136261u;
+    int len=key.length();
+    for(int i=0;i<len;++i)
+    {
+        h^=(unsigned char)key[i];
+        h*=16777619u;
+    }
+    return h? h:1;
 }
-int nasal_hash::get_value_address(std::string key)
+int nasal_hashmap::size() const
 {
-    int ret_value_addr=-1;
-    if(elems.find(key)!=elems.end())
-        return vm.mem_get(elems[key]);
-    else if(elems.find("parents")!=elems.end())
+    return alive;
+}
+int nasal_hashmap::slots() const
+{
+    return index.size();
+}
+int nasal_hashmap::find(const std::string& key,unsigned int h) const
+{
+    if(index.empty())
+        return -1;
+    int mask=index.size()-1;
+    // erased keys stay in index and never match,so probing goes on through them
+    for(int i=h&mask;index[i]>=0;i=(i+1)&mask)
     {
-        int mem_addr=elems["parents"];
-        int val_addr=vm.mem_get(mem_addr);
-        if(vm.gc_get(val_addr).get_type()==vm_vector)
+        int pos=index[i];
+        if(hashes[pos]==h && keys[pos]==key)
+            return pos;
+    }
+    return -1;
+}
+int nasal_hashmap::insert(const std::string& key,unsigned int h)
+{
+    // load factor of index is kept under 3/4
+    if((keys.size()+1)*4>index.size()*3)
+        rebuild();
+    int pos=keys.size();
+    keys.push_back(key);
+    hashes.push_back(h);
+    int mask=index.size()-1;
+    int i=h&mask;
+    while(index[i]>=0)
+        i=(i+1)&mask;
+    index[i]=pos;
+    ++alive;
+    return pos;
+}
+void nasal_hashmap::erase(int pos)
+{
+    keys[pos].clear();
+    hashes[pos]=0;
+    --alive;
+    return;
+}
+void nasal_hashmap::compact(std::vector<int>& vec)
+{
+    // keep the order of keys
+    int size=keys.size();
+    int cnt=0;
+    for(int i=0;i<size;++i)
+        if(hashes[i])
         {
-            nasal_vector& vec_ref=vm.gc_get(val_addr).get_vector();
-            int size=vec_ref.size();
-            for(int i=0;i<size;++i)
+            if(cnt!=i)
             {
-                int tmp_val_addr=vec_ref.get_value_address(i);
-                if(vm.gc_get(tmp_val_addr).get_type()==vm_hash)
-                    ret_value_addr=vm.gc_get(tmp_val_addr).get_hash().get_value_address(key);
-                if(ret_value_addr>=0)
-                    break;
+                keys[cnt].swap(keys[i]);
+                hashes[cnt]=hashes[i];
+                vec[cnt]=vec[i];
             }
+            ++cnt;
         }
+    keys.resize(cnt);
+    hashes.resize(cnt);
+    vec.resize(cnt);
+    rebuild();
+    return;
+}
+void nasal_hashmap::rebuild()
+{
+    int size=keys.size();
+    int capacity=8;
+    while(capacity*3<(size+1)*4*2)
+        capacity<<=1;
+    index.assign(capacity,-1);
+    int mask=capacity-1;
+    for(int pos=0;pos<size;++pos)
+    {
+        int i=hashes[pos]&mask;
+        while(index[i]>=0)
+            i=(i+1)&mask;
+        index[i]=pos;
+    }
+    return;
+}
+void nasal_hashmap::clear()
+{
+    keys.clear();
+    hashes.clear();
+    index.clear();
+    alive=0;
+    return;
+}
+
+/*functions of nasal_hash*/
+nasal_hash::nasal_hash(nasal_virtual_machine& nvm):vm(nvm)
+{
+    shape=vm.gc_root_shape();
+    proto=false;
+    parents_cache=NULL;
+    return;
+}
+nasal_hash::~nasal_hash()
+{
+    clear();
+    return;
+}
+void nasal_hash::clear()
+{
+    for(int i=0;i<(int)vals.size();++i)
+        if(shape->layout.hashes[i])
+            vm.del_reference(vals[i]);
+    vals.clear();
+    if(shape->dict)
+        delete shape;
+    shape=vm.gc_root_shape();
+    // caches may keep the pointer of this hash
+    if(proto)
+        vm.gc_shape_changed();
+    proto=false;
+    if(parents_cache)
+        delete []parents_cache;
+    parents_cache=NULL;
+    return;
+}
+void nasal_hash::clear_parents_cache()
+{
+    if(parents_cache)
+        for(int i=0;i<parents_cache_size;++i)
+            parents_cache[i].owner=NULL;
+    return;
+}
+void nasal_hash::set_dict()
+{
+    nasal_shape* tmp=new nasal_shape;
+    tmp->dict=true;
+    tmp->parents_slot=shape->parents_slot;
+    tmp->layout=shape->layout;
+    shape=tmp;
+    return;
+}
+void nasal_hash::add_elem(const std::string& key,int value_address)
+{
+    add_elem(key,nasal_hashmap::hash(key),value_address);
+    return;
+}
+void nasal_hash::add_elem(const std::string& key,unsigned int h,int value_address)
+{
+    if(shape->layout.find(key,h)>=0)
+        return;
+    if(!shape->dict && shape->layout.size()<shape_max_keys)
+        shape=vm.gc_shape_next(shape,key,h);
+    else
+    {
+        if(!shape->dict)
+            set_dict();
+        int slot=shape->layout.insert(key,h);
+        if(key=="parents")
+            shape->parents_slot=slot;
+    }
+    vals.push_back(value_address);
+    // new key may hide the member in parents
+    clear_parents_cache();
+    if(proto)
+        vm.gc_shape_changed();
+    return;
+}
+void nasal_hash::del_elem(const std::string& key)
+{
+    int slot=shape->layout.find(key,nasal_hashmap::hash(key));
+    if(slot<0)
+        return;
+    if(!shape->dict)
+        set_dict();
+    vm.del_reference(vals[slot]);
+    vals[slot]=-1;
+    shape->layout.erase(slot);
+    if(slot==shape->parents_slot)
+        shape->parents_slot=-1;
+    // erased slots are removed when they are more than alive ones
+    if(shape->layout.size()*2<(int)shape->layout.keys.size())
+    {
+        shape->layout.compact(vals);
+        shape->parents_slot=shape->layout.find("parents",nasal_hashmap::hash("parents"));
     }
-    return ret_value_addr;
+    clear_parents_cache();
+    if(proto)
+        vm.gc_shape_changed();
+    return;
+}
+int nasal_hash::size()
+{
+    return shape->layout.size();
+}
+int nasal_hash::get_special_para(const std::string& key)
+{
+    int slot=shape->layout.find(key,nasal_hashmap::hash(key));
+    return slot>=0? vals[slot]:-1;
 }
-int nasal_hash::get_mem_address(std::string key)
+nasal_hash* nasal_hash::find_owner(const std::string& key,unsigned int h,int& slot,int& owner_addr)
 {
-    int ret_mem_addr=-1;
-    if(elems.find(key)!=elems.end())
-        return elems[key];
-    else if(elems.find("parents")!=elems.end())
+    // owner_addr is set only when key is found in parents
+    slot=shape->layout.find(key,h);
+    if(slot>=0)
+        return this;
+    if(shape->parents_slot<0)
+        return NULL;
+    int val_addr=vals[shape->parents_slot];
+    if(vm.gc_get(val_addr).get_type()!=vm_vector)
+        return NULL;
+    nasal_vector& vec_ref=vm.gc_get(val_addr).get_vector();
+    vec_ref.proto=true;
+    // packed vector has no hash
+    int size=vec_ref.packed? 0:vec_ref.length;
+    for(int i=0;i<size;++i)
     {
-        int mem_addr=elems["parents"];
-        int val_addr=vm.mem_get(mem_addr);
-        if(vm.gc_get(val_addr).get_type()==vm_vector)
+        int tmp_val_addr=vec_ref.buf->elems[vec_ref.begin+i];
+        if(vm.gc_get(tmp_val_addr).get_type()!=vm_hash)
+            continue;
+        nasal_hash& tmp=vm.gc_get(tmp_val_addr).get_hash();
+        tmp.proto=true;
+        nasal_hash* owner=tmp.find_owner(key,h,slot,owner_addr);
+        if(owner)
         {
-            nasal_vector& vec_ref=vm.gc_get(val_addr).get_vector();
-            int size=vec_ref.size();
-            for(int i=0;i<size;++i)
-            {
-                int tmp_val_addr=vec_ref.get_value_address(i);
-                if(vm.gc_get(tmp_val_addr).get_type()==vm_hash)
-                    ret_mem_addr=vm.gc_get(tmp_val_addr).get_hash().get_mem_address(key);
-                if(ret_mem_addr>=0)
-                    break;
-            }
+            if(owner==&tmp)
+                owner_addr=tmp_val_addr;
+            return owner;
         }
     }
-    return ret_mem_addr;
+    return NULL;
 }
-bool nasal_hash::check_contain(std::string key)
+nasal_hash* nasal_hash::resolve(const std::string& key,unsigned int h,int& slot,int& owner_addr)
 {
-    if(elems.find(key)!=elems.end())
-        return true;
-    if(elems.find("parents")!=elems.end())
+    slot=shape->layout.find(key,h);
+    if(slot>=0)
+        return this;
+    if(shape->parents_slot<0)
+        return NULL;
+    nasal_parents_cache* entry=NULL;
+    if(parents_cache)
     {
-        bool result=false;
-        int mem_addr=elems["parents"];
-        int val_addr=vm.mem_get(mem_addr);
-        if(vm.gc_get(val_addr).get_type()==vm_vector)
+        entry=&parents_cache[h&(parents_cache_size-1)];
+        // owner is alive and its layout is not changed if epoch is the same
+        if(entry->owner && entry->hash==h && entry->epoch==vm.gc_shape_epoch() && entry->owner->shape->layout.keys[entry->slot]==key)
         {
-            nasal_vector& vec_ref=vm.gc_get(val_addr).get_vector();
-            int size=vec_ref.size();
-            for(int i=0;i<size;++i)
-            {
-                int tmp_val_addr=vec_ref.get_value_address(i);
-                if(vm.gc_get(tmp_val_addr).get_type()==vm_hash)
-                    result=vm.gc_get(tmp_val_addr).get_hash().check_contain(key);
-                if(result)
-                    break;
-            }
+            vm.gc_count_parents_cache(true);
+            slot=entry->slot;
+            owner_addr=entry->owner_addr;
+            return entry->owner;
         }
-        return result;
     }
-    return false;
+    vm.gc_count_parents_cache(false);
+    nasal_hash* owner=find_owner(key,h,slot,owner_addr);
+    if(!owner)
+        return NULL;
+    if(!parents_cache)
+    {
+        parents_cache=new nasal_parents_cache[parents_cache_size];
+        for(int i=0;i<parents_cache_size;++i)
+            parents_cache[i].owner=NULL;
+        entry=&parents_cache[h&(parents_cache_size-1)];
+    }
+    entry->hash=h;
+    entry->epoch=vm.gc_shape_epoch();
+    entry->owner=owner;
+    entry->owner_addr=owner_addr;
+    entry->slot=slot;
+    return owner;
+}
+int nasal_hash::get_value_address(const std::string& key)
+{
+    return get_value_address(key,nasal_hashmap::hash(key));
+}
+int nasal_hash::get_value_address(const std::string& key,unsigned int h)
+{
+    int slot,owner_addr;
+    nasal_hash* owner=resolve(key,h,slot,owner_addr);
+    return owner? owner->vals[slot]:-1;
+}
+int* nasal_hash::get_mem_address(const std::string& key)
+{
+    return get_mem_address(key,nasal_hashmap::hash(key));
+}
+int* nasal_hash::get_mem_address(const std::string& key,unsigned int h)
+{
+    int slot,owner_addr;
+    nasal_hash* owner=resolve(key,h,slot,owner_addr);
+    if(!owner)
+        return NULL;
+    // the member found in parents is going to be changed
+    if(owner!=this)
+        vm.gc_write_barrier(owner_addr);
+    // new parents makes all caches of members in parents invalid
+    if(slot==owner->shape->parents_slot)
+        vm.gc_shape_changed();
+    return &owner->vals[slot];
+}
+bool nasal_hash::check_contain(const std::string& key)
+{
+    return check_contain(key,nasal_hashmap::hash(key));
+}
+bool nasal_hash::check_contain(const std::string& key,unsigned int h)
+{
+    int slot,owner_addr;
+    return resolve(key,h,slot,owner_addr)!=NULL;
 }
 int nasal_hash::get_keys()
 {
+    // keys are given in insertion order
+    nasal_hashmap& layout=shape->layout;
     int ret_addr=vm.gc_alloc(vm_vector);
     nasal_vector& ref_vec=vm.gc_get(ret_addr).get_vector();
-    for(std::map<std::string,int>::iterator iter=elems.begin();iter!=elems.end();++iter)
-    {
-        int str_addr=vm.gc_alloc(vm_string);
-        vm.gc_get(str_addr).set_string(iter->first);
-        ref_vec.add_elem(str_addr);
-    }
+    for(int i=0;i<(int)layout.keys.size();++i)
+        if(layout.hashes[i])
+        {
+            int str_addr=vm.gc_alloc(vm_string);
+            vm.gc_get(str_addr).set_string(layout.keys[i]);
+            ref_vec.add_elem(str_addr);
+        }
     return ret_addr;
 }
 void nasal_hash::print()
 {
+    nasal_hashmap& layout=shape->layout;
     std::cout<<"{";
-    if(!elems.size())
-        std::cout<<"}";
-    for(std::map<std::string,int>::iterator i=elems.begin();i!=elems.end();++i)
+    bool first=true;
+    for(int i=0;i<(int)layout.keys.size();++i)
     {
-        std::cout<<i->first<<":";
-        nasal_scalar& tmp=vm.gc_get(vm.mem_get(i->second));
+        if(!layout.hashes[i])
+            continue;
+        if(!first)
+            std::cout<<",";
+        first=false;
+        std::cout<<layout.keys[i]<<":";
+        nasal_scalar& tmp=vm.gc_get(vals[i]);
         switch(tmp.get_type())
         {
             case vm_nil:std::cout<<"nil";break;
@@ -390,17 +1144,47 @@ void nasal_hash::print()
             case vm_hash:tmp.get_hash().print();break;
             case vm_function:std::cout<<"func(...){...}";break;
         }
-        std::cout<<",}"[(++i)==elems.end()];
-        --i;
     }
+    std::cout<<"}";
     return;
 }
+nasal_shape* nasal_hash::get_shape()
+{
+    return shape;
+}
+nasal_hash* nasal_hash::get_owner(const std::string& key,unsigned int h,int& slot)
+{
+    int owner_addr;
+    return resolve(key,h,slot,owner_addr);
+}
+nasal_hash* nasal_hash::get_first_parent()
+{
+    if(shape->parents_slot<0)
+        return NULL;
+    nasal_scalar& parents=vm.gc_get(vals[shape->parents_slot]);
+    if(parents.get_type()!=vm_vector)
+        return NULL;
+    nasal_vector& vec_ref=parents.get_vector();
+    if(vec_ref.packed || !vec_ref.length)
+        return NULL;
+    nasal_scalar& tmp=vm.gc_get(vec_ref.buf->elems[vec_ref.begin]);
+    return tmp.get_type()==vm_hash? &tmp.get_hash():NULL;
+}
+int nasal_hash::get_slot_value(int slot)
+{
+    return vals[slot];
+}
+int* nasal_hash::get_slot_mem(int slot)
+{
+    return &vals[slot];
+}
 
 /*functions of nasal_function*/
 nasal_function::nasal_function(nasal_virtual_machine& nvm):vm(nvm)
 {
     closure_addr=-1;
     dynamic_para_name="";
+    local_table=NULL;
     argument_list.clear();
     function_expr.clear();
     return;
@@ -457,10 +1241,27 @@ void nasal_function::set_closure_addr(int value_address)
     closure_addr=new_closure;
     return;
 }
+void nasal_function::bind_closure_addr(int value_address)
+{
+    // closure made for this function is used without copying
+    if(closure_addr>=0)
+        vm.del_reference(closure_addr);
+    closure_addr=value_address;
+    return;
+}
 int nasal_function::get_closure_addr()
 {
     return closure_addr;
 }
+void nasal_function::set_local_table(const nasal_hashmap* table)
+{
+    local_table=table;
+    return;
+}
+const nasal_hashmap* nasal_function::get_local_table()
+{
+    return local_table;
+}
 void nasal_function::set_arguments(nasal_ast& node)
 {
     argument_list=node;
@@ -481,127 +1282,189 @@ nasal_ast& nasal_function::get_run_block()
 }
 
 /*functions of nasal_closure*/
+nasal_scope::nasal_scope(const nasal_hashmap* t)
+{
+    table=t;
+    if(table)
+        slots.resize(table->size(),-1);
+    return;
+}
+const std::string& nasal_scope::get_name(int index)
+{
+    return table? table->keys[index]:names.keys[index];
+}
+int nasal_scope::find(const std::string& key,unsigned int h)
+{
+    return table? table->find(key,h):names.find(key,h);
+}
+
 nasal_closure::nasal_closure(nasal_virtual_machine& nvm):vm(nvm)
 {
-    std::map<std::string,int> new_scope;
-    elems.push_back(new_scope);
+    elems.push_back(nasal_scope(NULL));
+    version=0;
     return;
 }
 nasal_closure::~nasal_closure()
 {
-    for(std::list<std::map<std::string,int> >::iterator i=elems.begin();i!=elems.end();++i)
-        for(std::map<std::string,int>::iterator j=i->begin();j!=i->end();++j)
-            vm.mem_free(j->second);
+    for(std::list<nasal_scope>::iterator i=elems.begin();i!=elems.end();++i)
+        for(std::vector<int>::iterator j=i->slots.begin();j!=i->slots.end();++j)
+            if(*j>=0)
+                vm.del_reference(*j);
     elems.clear();
     return;
 }
-void nasal_closure::add_scope()
+void nasal_closure::add_scope(const nasal_hashmap* table,const int* values)
 {
-    std::map<std::string,int> new_scope;
-    elems.push_back(new_scope);
+    // values are copied from local slots of a call frame
+    ++version;
+    elems.push_back(nasal_scope(table));
+    if(!values)
+        return;
+    std::vector<int>& slots=elems.back().slots;
+    for(int i=0;i<(int)slots.size();++i)
+    {
+        slots[i]=values[i];
+        if(values[i]>=0)
+            vm.add_reference(values[i]);
+    }
     return;
 }
 void nasal_closure::del_scope()
 {
-    std::map<std::string,int>& last_scope=elems.back();
-    for(std::map<std::string,int>::iterator i=last_scope.begin();i!=last_scope.end();++i)
-        vm.mem_free(i->second);
+    nasal_scope& last_scope=elems.back();
+    for(std::vector<int>::iterator i=last_scope.slots.begin();i!=last_scope.slots.end();++i)
+        if(*i>=0)
+            vm.del_reference(*i);
     elems.pop_back();
+    ++version;
     return;
 }
-void nasal_closure::add_new_value(std::string key,int value_address)
+void nasal_closure::add_new_value(const std::string& key,int value_address)
 {
-    int new_mem_address=vm.mem_alloc(value_address);
-    if(elems.back().find(key)!=elems.back().end())
+    nasal_scope& last_scope=elems.back();
+    unsigned int h=nasal_hashmap::hash(key);
+    int index=last_scope.find(key,h);
+    if(index>=0)
     {
         // if this value already exists,delete the old value and update a new value
-        int old_mem_address=elems.back()[key];
-        vm.mem_free(old_mem_address);
+        if(last_scope.slots[index]>=0)
+            vm.del_reference(last_scope.slots[index]);
+        last_scope.slots[index]=value_address;
+        return;
+    }
+    // name is not in the table,so this scope keeps its own names from now on
+    ++version;
+    if(last_scope.table)
+    {
+        last_scope.names=*last_scope.table;
+        last_scope.table=NULL;
     }
-    elems.back()[key]=new_mem_address;
+    last_scope.names.insert(key,h);
+    last_scope.slots.push_back(value_address);
     return;
 }
-int nasal_closure::get_value_address(std::string key)
+int nasal_closure::get_value_address(const std::string& key)
 {
-    int ret_address=-1;
-    for(std::list<std::map<std::string,int> >::iterator i=elems.begin();i!=elems.end();++i)
-        if(i->find(key)!=i->end())
-            ret_address=vm.mem_get((*i)[key]);
-    return ret_address;
+    // inner scopes are at the back
+    unsigned int h=nasal_hashmap::hash(key);
+    for(std::list<nasal_scope>::reverse_iterator i=elems.rbegin();i!=elems.rend();++i)
+    {
+        int index=i->find(key,h);
+        if(index>=0 && i->slots[index]>=0)
+            return i->slots[index];
+    }
+    return -1;
 }
-int nasal_closure::get_mem_address(std::string key)
+int* nasal_closure::get_mem_address(const std::string& key)
 {
-    int ret_address=-1;
-    for(std::list<std::map<std::string,int> >::iterator i=elems.begin();i!=elems.end();++i)
-        if(i->find(key)!=i->end())
-            ret_address=(*i)[key];
-    return ret_address;
+    unsigned int h=nasal_hashmap::hash(key);
+    for(std::list<nasal_scope>::reverse_iterator i=elems.rbegin();i!=elems.rend();++i)
+    {
+        int index=i->find(key,h);
+        if(index>=0 && i->slots[index]>=0)
+            return &i->slots[index];
+    }
+    return NULL;
 }
 void nasal_closure::set_closure(nasal_closure& tmp)
 {
-    for(std::list<std::map<std::string,int> >::iterator i=elems.begin();i!=elems.end();++i)
-        for(std::map<std::string,int>::iterator j=i->begin();j!=i->end();++j)
-            vm.mem_free(j->second);
+    for(std::list<nasal_scope>::iterator i=elems.begin();i!=elems.end();++i)
+        for(std::vector<int>::iterator j=i->slots.begin();j!=i->slots.end();++j)
+            if(*j>=0)
+                vm.del_reference(*j);
     elems.clear();
-    for(std::list<std::map<std::string,int> >::iterator i=tmp.elems.begin();i!=tmp.elems.end();++i)
+    ++version;
+    for(std::list<nasal_scope>::iterator i=tmp.elems.begin();i!=tmp.elems.end();++i)
     {
-        std::map<std::string,int> new_scope;
-        elems.push_back(new_scope);
-        for(std::map<std::string,int>::iterator j=i->begin();j!=i->end();++j)
-        {
-            int value_addr=vm.mem_get(j->second);
-            int new_mem_addr=vm.mem_alloc(value_addr);
-            vm.add_reference(value_addr);
-            elems.back()[j->first]=new_mem_addr;
-        }
+        elems.push_back(*i);
+        for(std::vector<int>::iterator j=i->slots.begin();j!=i->slots.end();++j)
+            if(*j>=0)
+                vm.add_reference(*j);
     }
     return;
 }
-
-/*functions of nasal_scalar*/
-nasal_scalar::nasal_scalar()
+void nasal_closure::set_local(int index,int value_address)
 {
-    this->type=vm_nil;
-    this->scalar_ptr=(void*)NULL;
+    int& slot=elems.back().slots[index];
+    if(slot>=0)
+        vm.del_reference(slot);
+    slot=value_address;
     return;
 }
-nasal_scalar::~nasal_scalar()
+int nasal_closure::get_local(int index)
 {
-    // must set type and scalar_ptr to default first
-    // this operation will avoid SIGTRAP caused by circular reference
-    // circular reference will cause using destructor repeatedly
-    int tmp_type=this->type;
-    void* tmp_ptr=this->scalar_ptr;
+    return elems.back().slots[index];
+}
+int* nasal_closure::get_local_mem(int index)
+{
+    int* ret=&elems.back().slots[index];
+    return *ret>=0? ret:NULL;
+}
+const std::string& nasal_closure::get_local_name(int index)
+{
+    return elems.back().get_name(index);
+}
+unsigned int nasal_closure::get_version()
+{
+    return version;
+}
+nasal_scope* nasal_closure::get_single_scope()
+{
+    // closures made by newfunc have only one scope
+    return elems.size()==1? &elems.back():NULL;
+}
 
+/*functions of nasal_scalar*/
+nasal_scalar::nasal_scalar()
+{
     this->type=vm_nil;
-    this->scalar_ptr=NULL;
-    switch(tmp_type)
-    {
-        case vm_nil:      break;
-        case vm_number:   delete (double*)(tmp_ptr);         break;
-        case vm_string:   delete (std::string*)(tmp_ptr);    break;
-        case vm_vector:   delete (nasal_vector*)(tmp_ptr);   break;
-        case vm_hash:     delete (nasal_hash*)(tmp_ptr);     break;
-        case vm_function: delete (nasal_function*)(tmp_ptr); break;
-        case vm_closure:  delete (nasal_closure*)(tmp_ptr);  break;
-    }
+    this->str_len=0;
+    this->value.ptr=NULL;
+    return;
+}
+nasal_scalar::~nasal_scalar()
+{
+    clear();
     return;
 }
 void nasal_scalar::clear()
 {
-    // must set type and scalar_ptr to default first
+    // must set type and value to default first
     // this operation will avoid SIGTRAP caused by circular reference
     // circular reference will cause using destructor repeatedly
     int tmp_type=this->type;
-    void* tmp_ptr=this->scalar_ptr;
+    void* tmp_ptr=this->value.ptr;
 
     this->type=vm_nil;
-    this->scalar_ptr=NULL;
+    this->value.ptr=NULL;
     switch(tmp_type)
     {
         case vm_nil:      break;
-        case vm_number:   delete (double*)(tmp_ptr);         break;
-        case vm_string:   delete (std::string*)(tmp_ptr);    break;
+        case vm_number:   break;
+        case vm_string:
+            if(!--((nasal_string_buffer*)tmp_ptr)->share)
+                delete (nasal_string_buffer*)(tmp_ptr);
+            break;
         case vm_vector:   delete (nasal_vector*)(tmp_ptr);   break;
         case vm_hash:     delete (nasal_hash*)(tmp_ptr);     break;
         case vm_function: delete (nasal_function*)(tmp_ptr); break;
@@ -611,32 +1474,40 @@ void nasal_scalar::clear()
 }
 void nasal_scalar::set_type(int nasal_scalar_type,nasal_virtual_machine& nvm)
 {
-    if(this->scalar_ptr)
+    if(this->type!=vm_nil)
     {
-        std::cout<<">> [vm] scalar_ptr is in use: "<<type<<" "<<scalar_ptr<<"\n";
+        std::cout<<">> [vm] scalar is in use: "<<type<<"\n";
         return;
     }
     this->type=nasal_scalar_type;
     switch(nasal_scalar_type)
     {
-        case vm_nil:      this->scalar_ptr=(void*)NULL;                      break;
-        case vm_number:   this->scalar_ptr=(void*)(new double);              break;
-        case vm_string:   this->scalar_ptr=(void*)(new std::string);         break;
-        case vm_vector:   this->scalar_ptr=(void*)(new nasal_vector(nvm));   break;
-        case vm_hash:     this->scalar_ptr=(void*)(new nasal_hash(nvm));     break;
-        case vm_function: this->scalar_ptr=(void*)(new nasal_function(nvm)); break;
-        case vm_closure:  this->scalar_ptr=(void*)(new nasal_closure(nvm));  break;
+        case vm_nil:      this->value.ptr=NULL;                              break;
+        case vm_number:   this->value.num=0;                                 break;
+        case vm_string:   this->value.ptr=(void*)(new nasal_string_buffer); this->str_len=0; break;
+        case vm_vector:   this->value.ptr=(void*)(new nasal_vector(nvm));   break;
+        case vm_hash:     this->value.ptr=(void*)(new nasal_hash(nvm));     break;
+        case vm_function: this->value.ptr=(void*)(new nasal_function(nvm)); break;
+        case vm_closure:  this->value.ptr=(void*)(new nasal_closure(nvm));  break;
     }
     return;
 }
 void nasal_scalar::set_number(double num)
 {
-    *(double*)(this->scalar_ptr)=num;
+    this->value.num=num;
     return;
 }
-void nasal_scalar::set_string(std::string str)
+void nasal_scalar::set_string(const std::string& str)
 {
-    *(std::string*)(this->scalar_ptr)=str;
+    nasal_string_buffer* buf=(nasal_string_buffer*)(this->value.ptr);
+    if(buf->share>1)
+    {
+        --buf->share;
+        buf=new nasal_string_buffer;
+        this->value.ptr=(void*)buf;
+    }
+    buf->str=str;
+    this->str_len=str.length();
     return;
 }
 int nasal_scalar::get_type()
@@ -645,59 +1516,85 @@ int nasal_scalar::get_type()
 }
 double nasal_scalar::get_number()
 {
-    return *(double*)(this->scalar_ptr);
+    return this->value.num;
 }
-std::string nasal_scalar::get_string()
+const std::string& nasal_scalar::get_string()
 {
-    return *(std::string*)(this->scalar_ptr);
+    // string that is a shorter prefix of its buffer is flattened when it is read
+    nasal_string_buffer* buf=(nasal_string_buffer*)(this->value.ptr);
+    if(this->str_len!=(int)buf->str.length())
+    {
+        if(buf->share>1)
+        {
+            --buf->share;
+            nasal_string_buffer* tmp=new nasal_string_buffer;
+            tmp->str.assign(buf->str,0,this->str_len);
+            this->value.ptr=(void*)tmp;
+            buf=tmp;
+        }
+        else
+            buf->str.resize(this->str_len);
+    }
+    return buf->str;
 }
 nasal_vector& nasal_scalar::get_vector()
 {
-    return *(nasal_vector*)(this->scalar_ptr);
+    return *(nasal_vector*)(this->value.ptr);
 }
 nasal_hash& nasal_scalar::get_hash()
 {
-    return *(nasal_hash*)(this->scalar_ptr);
+    return *(nasal_hash*)(this->value.ptr);
 }
 nasal_function& nasal_scalar::get_func()
 {
-    return *(nasal_function*)(this->scalar_ptr);
+    return *(nasal_function*)(this->value.ptr);
 }
 nasal_closure& nasal_scalar::get_closure()
 {
-    return *(nasal_closure*)(this->scalar_ptr);
+    return *(nasal_closure*)(this->value.ptr);
 }
 
 /*functions of nasal_virtual_machine*/
 nasal_virtual_machine::nasal_virtual_machine()
 {
+    tracing=false;
+    nursery_size=4096;
+    nursery_top=0;
+    gc_alloc_count=0;
+    gc_threshold=4096;
+    minor_count=0;
+    major_count=0;
+    gc_step_budget=0;
+    gc_step_alloc=0;
+    idle_budget=0;
+    gc_phase=gc_phase_idle;
+    sweep_cursor=0;
+    sweep_alive=0;
+    root_provider=NULL;
+    root_provider_obj=NULL;
+    shape_epoch=0;
+    limit_units=0;
+    limit_bytes=0;
+    payload_bytes=sweep_bytes=0;
+    limit_state=gc_limit_ok;
+    limit_tick=0;
+    pinned_nil=-1;
+    pinned_small.resize(gc_small_int_max-gc_small_int_min,-1);
+    pinned_count=0;
     return;
 }
 nasal_virtual_machine::~nasal_virtual_machine()
 {
-    int gc_mem_size=garbage_collector_memory.size();
-    for(int i=0;i<gc_mem_size;++i)
-        if(garbage_collector_memory[i]->ref_cnt)
-        {
-            garbage_collector_memory[i]->ref_cnt=0;
-            garbage_collector_memory[i]->collected=true;
-            garbage_collector_memory[i]->elem.clear();
-        }
-    for(int i=0;i<gc_mem_size;++i)
-        delete garbage_collector_memory[i];
-    while(!garbage_collector_free_space.empty())
-        garbage_collector_free_space.pop();
-    while(!memory_manager_free_space.empty())
-        memory_manager_free_space.pop();
-    garbage_collector_memory.clear();
-    memory_manager_memory.clear();
+    // nursery will not be built again
+    tracing=false;
+    clear();
     return;
 }
 void nasal_virtual_machine::debug()
 {
     int gc_mem_size=garbage_collector_memory.size();
     for(int i=0;i<gc_mem_size;++i)
-        if(garbage_collector_memory[i]->ref_cnt)
+        if(!garbage_collector_memory[i]->collected)
         {
             std::cout<<">> [debug] "<<i<<": "<<garbage_collector_memory[i]->ref_cnt<<" ";
             switch(garbage_collector_memory[i]->elem.get_type())
@@ -718,110 +1615,1002 @@ void nasal_virtual_machine::clear()
 {
     int gc_mem_size=garbage_collector_memory.size();
     for(int i=0;i<gc_mem_size;++i)
-        if(garbage_collector_memory[i]->ref_cnt)
+        if(!garbage_collector_memory[i]->collected)
         {
             garbage_collector_memory[i]->ref_cnt=0;
             garbage_collector_memory[i]->collected=true;
             garbage_collector_memory[i]->elem.clear();
         }
-    for(int i=0;i<gc_mem_size;++i)
-        delete garbage_collector_memory[i];
-    while(!garbage_collector_free_space.empty())
-        garbage_collector_free_space.pop();
-    while(!memory_manager_free_space.empty())
-        memory_manager_free_space.pop();
+    // values pushed here by clearing are cleared in the loop above
+    pending_free.clear();
+    string_intern.clear();
+    pinned_nil=-1;
+    pinned_small.assign(gc_small_int_max-gc_small_int_min,-1);
+    pinned_bits.clear();
+    pinned_addr.clear();
+    pinned_count=0;
+    for(int i=0;i<(int)gc_slabs.size();++i)
+        delete []gc_slabs[i];
+    for(int i=0;i<(int)string_pool.size();++i)
+        delete string_pool[i];
+    for(int i=0;i<(int)vector_pool.size();++i)
+        delete vector_pool[i];
+    for(int i=0;i<(int)hash_pool.size();++i)
+        delete hash_pool[i];
+    gc_slabs.clear();
+    string_pool.clear();
+    vector_pool.clear();
+    hash_pool.clear();
+    // no hash uses shapes now
+    for(int i=0;i<(int)shape_list.size();++i)
+        delete shape_list[i];
+    shape_list.clear();
+    root_shape.next_keys.clear();
+    root_shape.next.clear();
+    ++shape_epoch;
+    garbage_collector_free_space.clear();
     garbage_collector_memory.clear();
-    memory_manager_memory.clear();
+    nursery_top=0;
+    nursery_forward.clear();
+    remembered_set.clear();
+    gc_mark_stack.clear();
+    gc_alloc_count=0;
+    gc_threshold=4096;
+    minor_count=0;
+    major_count=0;
+    gc_step_alloc=0;
+    idle_budget=0;
+    gc_phase=gc_phase_idle;
+    sweep_cursor=0;
+    sweep_alive=0;
+    payload_bytes=sweep_bytes=0;
+    limit_state=gc_limit_ok;
+    limit_tick=0;
+    stat=nasal_gc_stat();
+    if(tracing)
+        set_tracing(true);
     return;
 }
-int nasal_virtual_machine::gc_alloc(int val_type)
+void nasal_virtual_machine::set_tracing(bool enable)
+{
+    tracing=enable;
+    // nursery takes the first nursery_size units,so it must be built before any allocation
+    if(tracing && garbage_collector_memory.empty())
+    {
+        gc_new_slab(nursery_size);
+        // units in nursery are not managed by free space
+        garbage_collector_free_space.clear();
+        nursery_forward.resize(nursery_size,-1);
+        nursery_top=0;
+    }
+    return;
+}
+void nasal_virtual_machine::gc_new_slab(int slab_size)
+{
+    gc_unit* slab=new gc_unit[slab_size];
+    gc_slabs.push_back(slab);
+    int mem_size=garbage_collector_memory.size();
+    garbage_collector_memory.resize(mem_size+slab_size);
+    for(int i=0;i<slab_size;++i)
+        garbage_collector_memory[mem_size+i]=slab+i;
+    // push in reverse order so that units are given out from low address to high address
+    for(int i=mem_size+slab_size-1;i>=mem_size;--i)
+        garbage_collector_free_space.push_back(i);
+    return;
+}
+int nasal_virtual_machine::gc_new_unit()
 {
     if(garbage_collector_free_space.empty())
     {
-        int mem_size=garbage_collector_memory.size();
-        garbage_collector_memory.resize(mem_size+64);
-        for(int i=mem_size;i<mem_size+64;++i)
-        {
-            garbage_collector_memory[i]=new gc_unit;
-            garbage_collector_free_space.push(i);
-        }
+        // slabs grow geometrically,each new slab doubles the heap
+        int mem_size=garbage_collector_memory.size()-nursery_forward.size();
+        gc_new_slab(mem_size>64? mem_size:64);
     }
-    int ret=garbage_collector_free_space.front();
+    int ret=garbage_collector_free_space.back();
+    garbage_collector_free_space.pop_back();
     gc_unit& unit_ref=*garbage_collector_memory[ret];
     unit_ref.collected=false;
     unit_ref.ref_cnt=1;
-    unit_ref.elem.set_type(val_type,*this);
-    garbage_collector_free_space.pop();
+    // values allocated in old space during major collection must survive it
+    if(gc_phase==gc_phase_mark)
+        gc_mark_stack.push_back(ret);
+    else if(gc_phase==gc_phase_sweep && ret>=sweep_cursor)
+        unit_ref.marked=true;
     return ret;
 }
-nasal_scalar& nasal_virtual_machine::gc_get(int value_address)
+void nasal_virtual_machine::scalar_alloc(nasal_scalar& elem,int val_type)
 {
-    if(0<=value_address && value_address<garbage_collector_memory.size() && !garbage_collector_memory[value_address]->collected)
-        return garbage_collector_memory[value_address]->elem;
-    return error_returned_value;
+    if(val_type==vm_string && !string_pool.empty())
+    {
+        elem.type=vm_string;
+        elem.str_len=0;
+        elem.value.ptr=(void*)string_pool.back();
+        string_pool.pop_back();
+    }
+    else if(val_type==vm_vector && !vector_pool.empty())
+    {
+        elem.type=vm_vector;
+        elem.value.ptr=(void*)vector_pool.back();
+        vector_pool.pop_back();
+    }
+    else if(val_type==vm_hash && !hash_pool.empty())
+    {
+        elem.type=vm_hash;
+        elem.value.ptr=(void*)hash_pool.back();
+        hash_pool.pop_back();
+    }
+    else
+        elem.set_type(val_type,*this);
+    return;
 }
-void nasal_virtual_machine::add_reference(int value_address)
+void nasal_virtual_machine::scalar_free(nasal_scalar& elem)
 {
-    if(0<=value_address && value_address<garbage_collector_memory.size() && !garbage_collector_memory[value_address]->collected)
-        ++garbage_collector_memory[value_address]->ref_cnt;
+    // same as nasal_scalar::clear,but small payloads are given back to pools
+    // large ones are deleted so that pools will not hold too much memory
+    int type=elem.type;
+    void* ptr=elem.value.ptr;
+    if(type==vm_string)
+    {
+        elem.type=vm_nil;
+        elem.value.ptr=NULL;
+        nasal_string_buffer* buf=(nasal_string_buffer*)ptr;
+        if(--buf->share)
+            return;
+        if(string_pool.size()<4096 && buf->str.capacity()<=256)
+        {
+            buf->str.clear();
+            buf->share=1;
+            string_pool.push_back(buf);
+        }
+        else
+            delete buf;
+    }
+    else if(type==vm_vector && vector_pool.size()<4096 && ((nasal_vector*)ptr)->buf->elems.capacity()<=256 && ((nasal_vector*)ptr)->buf->nums.capacity()<=256)
+    {
+        elem.type=vm_nil;
+        elem.value.ptr=NULL;
+        ((nasal_vector*)ptr)->clear();
+        vector_pool.push_back((nasal_vector*)ptr);
+    }
+    else if(type==vm_hash && hash_pool.size()<4096 && ((nasal_hash*)ptr)->vals.capacity()<=256)
+    {
+        elem.type=vm_nil;
+        elem.value.ptr=NULL;
+        ((nasal_hash*)ptr)->clear();
+        hash_pool.push_back((nasal_hash*)ptr);
+    }
+    else
+        elem.clear();
     return;
 }
-void nasal_virtual_machine::del_reference(int value_address)
+void nasal_virtual_machine::set_nursery_size(int size)
 {
-    if(0<=value_address && value_address<garbage_collector_memory.size() && !garbage_collector_memory[value_address]->collected)
-        --garbage_collector_memory[value_address]->ref_cnt;
-    else
+    nursery_size=size>0? size:1;
+    return;
+}
+bool nasal_virtual_machine::gc_need_collect()
+{
+    // when major collection is in progress,each minor collection does one step of it
+    if(!tracing)
+        return false;
+    return nursery_top>=(int)nursery_forward.size() || idle_budget>0 || limit_state==gc_limit_collect || (gc_phase==gc_phase_idle && (gc_alloc_count>=gc_threshold || limit_state==gc_limit_recheck));
+}
+void nasal_virtual_machine::set_gc_step_budget(int budget)
+{
+    gc_step_budget=budget>0? budget:0;
+    return;
+}
+void nasal_virtual_machine::set_heap_limit(int units,long long bytes)
+{
+    limit_units=units>0? units:0;
+    limit_bytes=bytes>0? bytes:0;
+    return;
+}
+bool nasal_virtual_machine::gc_out_of_memory()
+{
+    return limit_state==gc_limit_exceeded;
+}
+void nasal_virtual_machine::gc_check_limit()
+{
+    // collection cannot be done in allocation,addresses of young values are still used by the caller
+    if(limit_state!=gc_limit_ok && limit_state!=gc_limit_recheck)
         return;
-    if(!garbage_collector_memory[value_address]->ref_cnt)
+    if((limit_units && stat.live_units>limit_units) || (limit_bytes && (long long)(stat.live_units*sizeof(gc_unit))+payload_bytes>limit_bytes))
+        limit_state=gc_limit_collect;
+    else if(limit_bytes && limit_state==gc_limit_ok && ++limit_tick>=gc_limit_interval)
+        limit_state=gc_limit_recheck;
+    return;
+}
+bool nasal_virtual_machine::gc_need_major()
+{
+    return tracing && (gc_phase!=gc_phase_idle || gc_alloc_count>=gc_threshold || limit_state!=gc_limit_ok);
+}
+void nasal_virtual_machine::gc_write_barrier(int value_address)
+{
+    // young values will be scanned in minor collection anyway
+    if(!tracing || value_address<(int)nursery_forward.size() || value_address>=(int)garbage_collector_memory.size())
+        return;
+    gc_unit& unit_ref=*garbage_collector_memory[value_address];
+    if(!unit_ref.remembered)
     {
-        garbage_collector_memory[value_address]->collected=true;
-        garbage_collector_memory[value_address]->elem.clear();
-        garbage_collector_free_space.push(value_address);
+        unit_ref.remembered=true;
+        remembered_set.push_back(value_address);
+    }
+    // scanned value may get unmarked children,so it is scanned again before marking finishes
+    if(gc_phase==gc_phase_mark && unit_ref.marked)
+    {
+        unit_ref.marked=false;
+        gc_mark_stack.push_back(value_address);
+    }
+    return;
+}
+int nasal_virtual_machine::gc_promote(int value_address)
+{
+    if(value_address<0 || value_address>=nursery_top)
+        return value_address;
+    if(nursery_forward[value_address]>=0)
+        return nursery_forward[value_address];
+    int ret=gc_new_unit();
+    // move the scalar without copying its data
+    nasal_scalar& from=garbage_collector_memory[value_address]->elem;
+    gc_unit& to=*garbage_collector_memory[ret];
+    to.elem.type=from.type;
+    to.elem.str_len=from.str_len;
+    to.elem.value=from.value;
+    from.type=vm_nil;
+    from.value.ptr=NULL;
+    // nasal_parents_cache keeps addresses of hashes in parents
+    if(to.elem.type==vm_hash && to.elem.get_hash().proto)
+        ++shape_epoch;
+    nursery_forward[value_address]=ret;
+    gc_scan_stack.push_back(ret);
+    ++gc_alloc_count;
+    if(gc_phase!=gc_phase_idle)
+        ++gc_step_alloc;
+    return ret;
+}
+void nasal_virtual_machine::gc_minor()
+{
+    // roots must be promoted by gc_promote before this
+    clock_t begin_time=clock();
+    for(std::vector<int>::iterator i=remembered_set.begin();i!=remembered_set.end();++i)
+    {
+        garbage_collector_memory[*i]->remembered=false;
+        gc_scan_stack.push_back(*i);
+    }
+    remembered_set.clear();
+    while(!gc_scan_stack.empty())
+    {
+        int addr=gc_scan_stack.back();
+        gc_scan_stack.pop_back();
+        gc_unit& unit_ref=*garbage_collector_memory[addr];
+        if(unit_ref.collected)
+            continue;
+        switch(unit_ref.elem.get_type())
+        {
+            case vm_vector:
+            {
+                // only elements in range are used,buffer may be shared with other vectors
+                nasal_vector& ref=unit_ref.elem.get_vector();
+                if(!ref.packed)
+                    for(int i=ref.begin;i<ref.begin+ref.length;++i)
+                        ref.buf->elems[i]=gc_promote(ref.buf->elems[i]);
+                break;
+            }
+            case vm_hash:
+            {
+                nasal_hash& ref=unit_ref.elem.get_hash();
+                for(int i=0;i<(int)ref.vals.size();++i)
+                    if(ref.shape->layout.hashes[i])
+                        ref.vals[i]=gc_promote(ref.vals[i]);
+                break;
+            }
+            case vm_function:
+            {
+                nasal_function& ref=unit_ref.elem.get_func();
+                ref.closure_addr=gc_promote(ref.closure_addr);
+                for(std::vector<int>::iterator i=ref.default_para_addr.begin();i!=ref.default_para_addr.end();++i)
+                    *i=gc_promote(*i);
+                break;
+            }
+            case vm_closure:
+            {
+                std::list<nasal_scope>& ref=unit_ref.elem.get_closure().elems;
+                for(std::list<nasal_scope>::iterator i=ref.begin();i!=ref.end();++i)
+                    for(std::vector<int>::iterator j=i->slots.begin();j!=i->slots.end();++j)
+                        *j=gc_promote(*j);
+                break;
+            }
+        }
+    }
+    // values left in nursery are unreachable,moved values are already empty
+    for(int i=0;i<nursery_top;++i)
+    {
+        gc_unit& unit_ref=*garbage_collector_memory[i];
+        if(nursery_forward[i]<0)
+            gc_count_free(unit_ref.elem);
+        unit_ref.collected=true;
+        unit_ref.ref_cnt=0;
+        scalar_free(unit_ref.elem);
+        nursery_forward[i]=-1;
+    }
+    nursery_top=0;
+    ++minor_count;
+    stat.gc_time+=(double)(clock()-begin_time)/CLOCKS_PER_SEC;
+    return;
+}
+void nasal_virtual_machine::gc_mark(int value_address)
+{
+    if(gc_phase==gc_phase_idle)
+        gc_phase=gc_phase_mark;
+    // old values that are not freed by sweeping are all reachable,so roots need no marking
+    if(gc_phase==gc_phase_mark)
+        gc_mark_stack.push_back(value_address);
+    return;
+}
+int nasal_virtual_machine::gc_mark_step(int budget)
+{
+    // budget<=0 means no limit,each scanned value costs 1+number of its children
+    int work=0;
+    while(!gc_mark_stack.empty() && (budget<=0 || work<budget))
+    {
+        int addr=gc_mark_stack.back();
+        gc_mark_stack.pop_back();
+        // young values are pushed here again when they are promoted
+        if(addr<(int)nursery_forward.size() || addr>=(int)garbage_collector_memory.size())
+            continue;
+        gc_unit& unit_ref=*garbage_collector_memory[addr];
+        if(unit_ref.collected || unit_ref.marked)
+            continue;
+        unit_ref.marked=true;
+        int size=gc_mark_stack.size();
+        switch(unit_ref.elem.get_type())
+        {
+            case vm_vector:
+            {
+                nasal_vector& ref=unit_ref.elem.get_vector();
+                if(!ref.packed)
+                    for(int i=ref.begin;i<ref.begin+ref.length;++i)
+                        gc_mark_stack.push_back(ref.buf->elems[i]);
+                break;
+            }
+            case vm_hash:
+            {
+                nasal_hash& ref=unit_ref.elem.get_hash();
+                for(int i=0;i<(int)ref.vals.size();++i)
+                    if(ref.shape->layout.hashes[i])
+                        gc_mark_stack.push_back(ref.vals[i]);
+                break;
+            }
+            case vm_function:
+            {
+                nasal_function& ref=unit_ref.elem.get_func();
+                gc_mark_stack.push_back(ref.closure_addr);
+                for(std::vector<int>::iterator i=ref.default_para_addr.begin();i!=ref.default_para_addr.end();++i)
+                    gc_mark_stack.push_back(*i);
+                break;
+            }
+            case vm_closure:
+            {
+                std::list<nasal_scope>& ref=unit_ref.elem.get_closure().elems;
+                for(std::list<nasal_scope>::iterator i=ref.begin();i!=ref.end();++i)
+                    for(std::vector<int>::iterator j=i->slots.begin();j!=i->slots.end();++j)
+                        if(*j>=0)
+                            gc_mark_stack.push_back(*j);
+                break;
+            }
+        }
+        work+=1+gc_mark_stack.size()-size;
+    }
+    return work;
+}
+int nasal_virtual_machine::gc_sweep_step(int budget)
+{
+    // values that are not marked cannot be reached from roots
+    // clearing them will not touch other values' reference count in tracing mode
+    // nursery is empty after minor collection,so only old space is swept
+    int gc_mem_size=garbage_collector_memory.size();
+    int work=0;
+    while(sweep_cursor<gc_mem_size && (budget<=0 || work<budget))
+    {
+        gc_unit& unit_ref=*garbage_collector_memory[sweep_cursor];
+        if(unit_ref.marked || unit_ref.permanent)
+        {
+            unit_ref.marked=false;
+            ++sweep_alive;
+            if(limit_bytes)
+                sweep_bytes+=scalar_bytes(unit_ref.elem);
+        }
+        else if(!unit_ref.collected)
+        {
+            gc_count_free(unit_ref.elem);
+            unit_ref.collected=true;
+            unit_ref.ref_cnt=0;
+            scalar_free(unit_ref.elem);
+            garbage_collector_free_space.push_back(sweep_cursor);
+        }
+        ++sweep_cursor;
+        ++work;
+    }
+    if(sweep_cursor<gc_mem_size)
+        return work;
+    // heap can grow up to twice the size of alive values before next collection
+    gc_phase=gc_phase_idle;
+    gc_alloc_count=0;
+    gc_threshold=sweep_alive>4096? sweep_alive:4096;
+    ++major_count;
+    // heap is measured exactly now,so it is really out of memory if it is still over the limit
+    payload_bytes=sweep_bytes;
+    limit_state=gc_limit_ok;
+    limit_tick=0;
+    gc_check_limit();
+    if(limit_state==gc_limit_collect)
+        limit_state=gc_limit_exceeded;
+    return work;
+}
+void nasal_virtual_machine::gc_major_step(int step_budget)
+{
+    clock_t begin_time=clock();
+    int work=0;
+    // collection asked by heap limit is done at once
+    int asked=step_budget<0? gc_step_budget:step_budget;
+    int budget=limit_state==gc_limit_collect? 0:asked;
+    // marking must go faster than the program moves values into old space,otherwise it never finishes
+    if(budget>0 && budget<gc_step_alloc*gc_step_ratio)
+        budget=gc_step_alloc*gc_step_ratio;
+    // old space has grown by another threshold since this collection began,so it is finished at once
+    if(gc_alloc_count>=2*gc_threshold)
+        budget=0;
+    gc_step_alloc=0;
+    if(gc_phase==gc_phase_mark)
+    {
+        work=gc_mark_step(budget);
+        // roots are marked just before this and nursery is empty after minor collection
+        // so marking is finished when there is no value left to scan
+        if(gc_mark_stack.empty())
+        {
+            gc_phase=gc_phase_sweep;
+            sweep_cursor=nursery_forward.size();
+            sweep_alive=0;
+            sweep_bytes=0;
+        }
     }
+    if(gc_phase==gc_phase_sweep && (!budget || work<budget))
+        work+=gc_sweep_step(budget-work);
+    if(work>stat.max_step_work)
+        stat.max_step_work=work;
+    if(asked>0 && work>asked)
+        ++stat.over_budget;
+    stat.gc_time+=(double)(clock()-begin_time)/CLOCKS_PER_SEC;
     return;
 }
-int nasal_virtual_machine::mem_alloc(int value_address)
+void nasal_virtual_machine::gc_idle(int budget)
 {
-    if(memory_manager_free_space.empty())
+    // roots are only known by the interpreter,so in tracing mode it does the work at its next safe point
+    if(budget<=0)
+        return;
+    if(tracing)
     {
-        int mem_size=memory_manager_memory.size();
-        memory_manager_memory.resize(mem_size+256);
-        for(int i=mem_size;i<mem_size+256;++i)
-            memory_manager_free_space.push(i);
+        idle_budget=budget;
+        return;
     }
-    int ret=memory_manager_free_space.front();
-    memory_manager_memory[ret]=value_address;
-    memory_manager_free_space.pop();
+    clock_t begin_time=clock();
+    gc_free_pending(budget);
+    stat.gc_time+=(double)(clock()-begin_time)/CLOCKS_PER_SEC;
+    gc_count_pause(begin_time);
+    return;
+}
+int nasal_virtual_machine::gc_take_idle()
+{
+    int ret=idle_budget>0? idle_budget:-1;
+    idle_budget=0;
     return ret;
 }
-void nasal_virtual_machine::mem_free(int memory_address)
+void nasal_virtual_machine::gc_count_pause(clock_t begin_time)
 {
-    // mem_free has helped scalar to delete the reference
-    // so don't need to delete reference again
-    if(0<=memory_address && memory_address<memory_manager_memory.size())
+    double pause=(double)(clock()-begin_time)/CLOCKS_PER_SEC;
+    if(pause>stat.max_pause)
+        stat.max_pause=pause;
+    return;
+}
+int nasal_virtual_machine::gc_free_pending(int budget)
+{
+    // freeing a value may make its children's reference count 0,they are pushed here instead of freed at once
+    int work=0;
+    while(!pending_free.empty() && (budget<=0 || work<budget))
     {
-        this->del_reference(memory_manager_memory[memory_address]);
-        memory_manager_free_space.push(memory_address);
+        int addr=pending_free.back();
+        pending_free.pop_back();
+        ++work;
+        gc_unit& unit_ref=*garbage_collector_memory[addr];
+        if(unit_ref.collected || unit_ref.ref_cnt)
+            continue;
+        gc_count_free(unit_ref.elem);
+        unit_ref.collected=true;
+        scalar_free(unit_ref.elem);
+        garbage_collector_free_space.push_back(addr);
     }
+    return work;
+}
+int nasal_virtual_machine::gc_minor_count()
+{
+    return minor_count;
+}
+int nasal_virtual_machine::gc_major_count()
+{
+    return major_count;
+}
+void nasal_virtual_machine::gc_count_free(nasal_scalar& elem)
+{
+    ++stat.free_count[elem.type];
+    --stat.live_units;
     return;
 }
-void nasal_virtual_machine::mem_change(int memory_address,int value_address)
+long long nasal_virtual_machine::scalar_bytes(nasal_scalar& elem)
+{
+    long long ret=0;
+    switch(elem.type)
+    {
+        case vm_string:
+        {
+            nasal_string_buffer* buf=(nasal_string_buffer*)elem.value.ptr;
+            ret=(sizeof(nasal_string_buffer)+buf->str.capacity())/buf->share;
+            break;
+        }
+        case vm_vector:
+        {
+            // shared buffer is divided among the vectors using it
+            nasal_vector_buffer* buf=elem.get_vector().buf;
+            ret=sizeof(nasal_vector)+(sizeof(nasal_vector_buffer)+buf->elems.capacity()*sizeof(int)+buf->nums.capacity()*sizeof(double))/buf->share;
+            break;
+        }
+        case vm_hash:
+        {
+            nasal_hash& ref=elem.get_hash();
+            ret=sizeof(nasal_hash)+ref.vals.capacity()*sizeof(int);
+            // shapes in transition tree are shared,only the shape of dictionary mode is owned by hash
+            if(ref.shape->dict)
+            {
+                nasal_hashmap& layout=ref.shape->layout;
+                ret+=sizeof(nasal_shape)+layout.keys.capacity()*sizeof(std::string)+layout.hashes.capacity()*sizeof(unsigned int)+layout.slots()*sizeof(int);
+                for(int i=0;i<(int)layout.keys.size();++i)
+                    ret+=layout.keys[i].capacity();
+            }
+            break;
+        }
+        case vm_function:
+        {
+            nasal_function& ref=elem.get_func();
+            ret=sizeof(nasal_function)+ref.default_para_addr.capacity()*sizeof(int)+ref.para_name.capacity()*sizeof(std::string);
+            break;
+        }
+        case vm_closure:
+        {
+            std::list<nasal_scope>& ref=elem.get_closure().elems;
+            ret=sizeof(nasal_closure);
+            for(std::list<nasal_scope>::iterator i=ref.begin();i!=ref.end();++i)
+            {
+                nasal_hashmap& names=i->names;
+                ret+=sizeof(nasal_scope)+2*sizeof(void*)+i->slots.capacity()*sizeof(int);
+                ret+=names.keys.capacity()*sizeof(std::string)+names.hashes.capacity()*sizeof(unsigned int)+names.slots()*sizeof(int);
+            }
+            break;
+        }
+    }
+    return ret;
+}
+nasal_gc_stat nasal_virtual_machine::gc_stat()
+{
+    // live values are counted by scanning the heap,so this is O(heap size)
+    nasal_gc_stat ret=stat;
+    int gc_mem_size=garbage_collector_memory.size();
+    for(int i=0;i<gc_mem_size;++i)
+    {
+        gc_unit& unit_ref=*garbage_collector_memory[i];
+        if(unit_ref.collected)
+            continue;
+        ++ret.live_count[unit_ref.elem.type];
+        ret.live_bytes+=sizeof(gc_unit)+scalar_bytes(unit_ref.elem);
+    }
+    ret.heap_units=gc_mem_size;
+    ret.free_list=garbage_collector_free_space.size();
+    ret.nursery_used=nursery_top;
+    ret.nursery_size=nursery_forward.size();
+    ret.remembered=remembered_set.size();
+    ret.pool_size=string_pool.size()+vector_pool.size()+hash_pool.size();
+    ret.minor_count=minor_count;
+    ret.major_count=major_count;
+    return ret;
+}
+void nasal_virtual_machine::gc_stat_print()
 {
-    // this progress is used to change a memory space's value address
-    // be careful! this process doesn't check if this mem_space is in use.
-    if(0<=memory_address && memory_address<memory_manager_memory.size())
+    const char* type_name[]={"nil","number","string","closure","function","vector","hash"};
+    nasal_gc_stat info=gc_stat();
+    std::cout<<">> [gc] type      alloc      free       live\n";
+    for(int i=0;i<=vm_hash;++i)
     {
-        this->del_reference(memory_manager_memory[memory_address]);
-        memory_manager_memory[memory_address]=value_address;
+        std::cout<<">> [gc] "<<type_name[i];
+        for(int j=strlen(type_name[i]);j<10;++j)
+            std::cout<<' ';
+        std::cout<<info.alloc_count[i]<<'\t'<<info.free_count[i]<<'\t'<<info.live_count[i]<<'\n';
     }
+    std::cout<<">> [gc] live "<<info.live_units<<" units("<<info.live_bytes<<" bytes),peak "<<info.peak_live_units<<" units\n";
+    std::cout<<">> [gc] heap "<<info.heap_units<<" units("<<info.heap_units*sizeof(gc_unit)<<" bytes),free list "<<info.free_list<<",pooled payloads "<<info.pool_size<<'\n';
+    std::cout<<">> [gc] nursery "<<info.nursery_used<<"/"<<info.nursery_size<<",remembered "<<info.remembered<<'\n';
+    std::cout<<">> [gc] minor "<<info.minor_count<<",major "<<info.major_count<<",time "<<info.gc_time<<"s\n";
+    std::cout<<">> [gc] longest pause "<<info.max_pause<<"s,most work of one major step "<<info.max_step_work<<" units,steps over budget "<<info.over_budget<<'\n';
+    std::cout<<">> [gc] parents cache hit "<<info.parents_hit<<",miss "<<info.parents_miss<<'\n';
     return;
 }
-int nasal_virtual_machine::mem_get(int memory_address)
+void nasal_virtual_machine::set_root_provider(void (*func)(void*,std::vector<int>&),void* obj)
 {
-    // be careful! this process doesn't check if this mem_space is in use.
-    if(0<=memory_address && memory_address<memory_manager_memory.size())
-        return memory_manager_memory[memory_address];
-    return -1;
+    root_provider=func;
+    root_provider_obj=obj;
+    return;
+}
+void nasal_virtual_machine::gc_roots(std::vector<int>& roots)
+{
+    if(root_provider)
+        root_provider(root_provider_obj,roots);
+    return;
+}
+void nasal_virtual_machine::gc_dump_edge(std::ofstream& fout,int value_address,std::string label)
+{
+    // label may contain any character,so it is written with its length
+    fout<<' '<<value_address<<' '<<label.length()<<' '<<label;
+    return;
+}
+bool nasal_virtual_machine::gc_dump(std::string filename,std::vector<int>& roots)
+{
+/*
+    heap snapshot format:
+    nasal-heap 1 <tracing|refcount>
+    r <address>
+    u <address> <type> <ref_cnt> <bytes> <edge count> {<address> <label length> <label>}
+*/
+    std::ofstream fout(filename.c_str());
+    if(fout.fail())
+        return false;
+    fout<<"nasal-heap 1 "<<(tracing? "tracing":"refcount")<<'\n';
+    for(std::vector<int>::iterator i=roots.begin();i!=roots.end();++i)
+        if(*i>=0)
+            fout<<"r "<<*i<<'\n';
+    int gc_mem_size=garbage_collector_memory.size();
+    for(int i=0;i<gc_mem_size;++i)
+    {
+        gc_unit& unit_ref=*garbage_collector_memory[i];
+        if(unit_ref.collected)
+            continue;
+        nasal_scalar& elem=unit_ref.elem;
+        if(unit_ref.permanent)
+            fout<<"r "<<i<<'\n';
+        fout<<"u "<<i<<' '<<elem.type<<' '<<unit_ref.ref_cnt<<' '<<sizeof(gc_unit)+scalar_bytes(elem);
+        switch(elem.type)
+        {
+            case vm_vector:
+            {
+                nasal_vector& ref=elem.get_vector();
+                int size=ref.packed? 0:ref.length;
+                fout<<' '<<size;
+                for(int j=0;j<size;++j)
+                    gc_dump_edge(fout,ref.buf->elems[ref.begin+j],"["+trans_number_to_string((double)j)+"]");
+                break;
+            }
+            case vm_hash:
+            {
+                nasal_hash& ref=elem.get_hash();
+                nasal_hashmap& layout=ref.shape->layout;
+                fout<<' '<<ref.size();
+                for(int j=0;j<(int)ref.vals.size();++j)
+                    if(layout.hashes[j])
+                        gc_dump_edge(fout,ref.vals[j],layout.keys[j]);
+                break;
+            }
+            case vm_function:
+            {
+                nasal_function& ref=elem.get_func();
+                int cnt=ref.closure_addr>=0;
+                for(int j=0;j<(int)ref.default_para_addr.size();++j)
+                    cnt+=ref.default_para_addr[j]>=0;
+                fout<<' '<<cnt;
+                if(ref.closure_addr>=0)
+                    gc_dump_edge(fout,ref.closure_addr,"<closure>");
+                for(int j=0;j<(int)ref.default_para_addr.size();++j)
+                    if(ref.default_para_addr[j]>=0)
+                        gc_dump_edge(fout,ref.default_para_addr[j],j<(int)ref.para_name.size()? ref.para_name[j]:"<default>");
+                break;
+            }
+            case vm_closure:
+            {
+                std::list<nasal_scope>& ref=elem.get_closure().elems;
+                int cnt=0;
+                for(std::list<nasal_scope>::iterator j=ref.begin();j!=ref.end();++j)
+                    for(int k=0;k<(int)j->slots.size();++k)
+                        cnt+=(j->slots[k]>=0);
+                fout<<' '<<cnt;
+                for(std::list<nasal_scope>::iterator j=ref.begin();j!=ref.end();++j)
+                    for(int k=0;k<(int)j->slots.size();++k)
+                        if(j->slots[k]>=0)
+                            gc_dump_edge(fout,j->slots[k],j->get_name(k));
+                break;
+            }
+            default:fout<<" 0";break;
+        }
+        fout<<'\n';
+    }
+    fout.close();
+    return true;
+}
+int nasal_virtual_machine::gc_link(int value_address,const std::string& str)
+{
+    // if left string is the longest user of its buffer,str is appended to the buffer in place
+    // and the new string shares this buffer,so s~=piece in loop costs amortized O(length of piece)
+    int ret=gc_alloc_unit(vm_string);
+    nasal_scalar& left=gc_get(value_address);
+    nasal_scalar& elem=garbage_collector_memory[ret]->elem;
+    nasal_string_buffer* buf=(nasal_string_buffer*)left.value.ptr;
+    if(left.str_len==(int)buf->str.length())
+    {
+        if(&str==&buf->str)
+            buf->str+=std::string(str);
+        else
+            buf->str+=str;
+        ++buf->share;
+    }
+    else
+    {
+        nasal_string_buffer* tmp=string_pool.empty()? new nasal_string_buffer:string_pool.back();
+        if(!string_pool.empty())
+            string_pool.pop_back();
+        tmp->str.reserve(left.str_len+str.length());
+        tmp->str.assign(buf->str,0,left.str_len);
+        tmp->str+=str;
+        buf=tmp;
+    }
+    elem.type=vm_string;
+    elem.str_len=buf->str.length();
+    elem.value.ptr=(void*)buf;
+    if(tracing && (limit_units || limit_bytes))
+    {
+        payload_bytes+=str.length();
+        gc_check_limit();
+    }
+    return ret;
+}
+int nasal_virtual_machine::gc_intern(const std::string& str)
+{
+    std::map<std::string,int>::iterator iter=string_intern.find(str);
+    if(iter!=string_intern.end())
+        return iter->second;
+    // interned strings are put in old space directly and never freed by collection or reference counting
+    int ret=gc_new_unit();
+    gc_unit& unit_ref=*garbage_collector_memory[ret];
+    unit_ref.permanent=true;
+    scalar_alloc(unit_ref.elem,vm_string);
+    unit_ref.elem.set_string(str);
+    unit_ref.str_hash=nasal_hashmap::hash(str);
+    ++stat.alloc_count[vm_string];
+    if(++stat.live_units>stat.peak_live_units)
+        stat.peak_live_units=stat.live_units;
+    string_intern[str]=ret;
+    return ret;
+}
+unsigned int nasal_virtual_machine::gc_string_hash(int value_address)
+{
+    // permanent strings are only made by gc_intern
+    gc_unit& unit_ref=*garbage_collector_memory[value_address];
+    if(unit_ref.permanent && unit_ref.elem.get_type()==vm_string)
+        return unit_ref.str_hash;
+    return nasal_hashmap::hash(unit_ref.elem.get_string());
+}
+int nasal_virtual_machine::gc_new_pinned(int val_type,double num)
+{
+    // pinned values are put in old space directly like interned strings
+    int ret=gc_new_unit();
+    gc_unit& unit_ref=*garbage_collector_memory[ret];
+    unit_ref.permanent=true;
+    scalar_alloc(unit_ref.elem,val_type);
+    if(val_type==vm_number)
+        unit_ref.elem.set_number(num);
+    ++stat.alloc_count[val_type];
+    if(++stat.live_units>stat.peak_live_units)
+        stat.peak_live_units=stat.live_units;
+    return ret;
+}
+int nasal_virtual_machine::gc_pinned_pos(unsigned long long bits)
+{
+    // open addressing with linear probing,size of table is power of 2
+    int mask=pinned_bits.size()-1;
+    int pos=(int)((bits*0x9e3779b97f4a7c15ULL)>>32)&mask;
+    while(pinned_addr[pos]!=-2 && pinned_bits[pos]!=bits)
+        pos=(pos+1)&mask;
+    return pos;
+}
+void nasal_virtual_machine::gc_pin_number(double num)
+{
+    unsigned long long bits;
+    memcpy(&bits,&num,sizeof(bits));
+    if((int)pinned_bits.size()<=2*pinned_count)
+    {
+        std::vector<unsigned long long> old_bits;
+        std::vector<int> old_addr;
+        old_bits.swap(pinned_bits);
+        old_addr.swap(pinned_addr);
+        int new_size=old_bits.size()? 2*old_bits.size():16;
+        pinned_bits.resize(new_size,0);
+        pinned_addr.resize(new_size,-2);
+        for(int i=0;i<(int)old_bits.size();++i)
+            if(old_addr[i]!=-2)
+            {
+                int pos=gc_pinned_pos(old_bits[i]);
+                pinned_bits[pos]=old_bits[i];
+                pinned_addr[pos]=old_addr[i];
+            }
+    }
+    // -2 means empty,-1 means the number is not boxed yet
+    int pos=gc_pinned_pos(bits);
+    if(pinned_addr[pos]==-2)
+    {
+        pinned_bits[pos]=bits;
+        pinned_addr[pos]=-1;
+        ++pinned_count;
+    }
+    return;
+}
+int nasal_virtual_machine::gc_box_nil()
+{
+    if(!tracing)
+        return gc_alloc(vm_nil);
+    if(pinned_nil<0)
+        pinned_nil=gc_new_pinned(vm_nil,0);
+    return pinned_nil;
+}
+int nasal_virtual_machine::gc_box_number(double num)
+{
+    if(tracing)
+    {
+        // -0 is not shared with 0
+        if(gc_small_int_min<=num && num<gc_small_int_max && num==(int)num && !(num==0 && std::signbit(num)))
+        {
+            int& addr=pinned_small[(int)num-gc_small_int_min];
+            if(addr<0)
+                addr=gc_new_pinned(vm_number,num);
+            return addr;
+        }
+        if(pinned_count)
+        {
+            unsigned long long bits;
+            memcpy(&bits,&num,sizeof(bits));
+            int pos=gc_pinned_pos(bits);
+            if(pinned_addr[pos]!=-2)
+            {
+                if(pinned_addr[pos]<0)
+                    pinned_addr[pos]=gc_new_pinned(vm_number,num);
+                return pinned_addr[pos];
+            }
+        }
+    }
+    // reference counting mode may change numbers in place,so each box is new
+    int ret=gc_alloc(vm_number);
+    garbage_collector_memory[ret]->elem.set_number(num);
+    return ret;
+}
+nasal_shape* nasal_virtual_machine::gc_root_shape()
+{
+    return &root_shape;
+}
+nasal_shape* nasal_virtual_machine::gc_shape_next(nasal_shape* from,const std::string& key,unsigned int h)
+{
+    int pos=from->next_keys.find(key,h);
+    if(pos>=0)
+        return from->next[pos];
+    nasal_shape* to=new nasal_shape;
+    to->layout=from->layout;
+    to->parents_slot=from->parents_slot;
+    int slot=to->layout.insert(key,h);
+    if(key=="parents")
+        to->parents_slot=slot;
+    from->next_keys.insert(key,h);
+    from->next.push_back(to);
+    shape_list.push_back(to);
+    return to;
+}
+void nasal_virtual_machine::gc_shape_changed()
+{
+    ++shape_epoch;
+    return;
+}
+unsigned int nasal_virtual_machine::gc_shape_epoch()
+{
+    return shape_epoch;
+}
+void nasal_virtual_machine::gc_count_parents_cache(bool hit)
+{
+    if(hit)
+        ++stat.parents_hit;
+    else
+        ++stat.parents_miss;
+    return;
+}
+int nasal_virtual_machine::gc_alloc(int val_type)
+{
+    if(!pending_free.empty())
+    {
+        clock_t begin_time=clock();
+        gc_free_pending(gc_step_budget);
+        stat.gc_time+=(double)(clock()-begin_time)/CLOCKS_PER_SEC;
+        gc_count_pause(begin_time);
+    }
+    int ret=gc_alloc_unit(val_type);
+    scalar_alloc(garbage_collector_memory[ret]->elem,val_type);
+    if(tracing && (limit_units || limit_bytes))
+    {
+        if(limit_bytes)
+            payload_bytes+=scalar_bytes(garbage_collector_memory[ret]->elem);
+        gc_check_limit();
+    }
+    return ret;
+}
+int nasal_virtual_machine::gc_alloc_unit(int val_type)
+{
+    // unit is given with an empty scalar
+    ++stat.alloc_count[val_type];
+    if(++stat.live_units>stat.peak_live_units)
+        stat.peak_live_units=stat.live_units;
+    if(tracing && nursery_top<(int)nursery_forward.size())
+    {
+        gc_unit& unit_ref=*garbage_collector_memory[nursery_top];
+        unit_ref.collected=false;
+        unit_ref.ref_cnt=1;
+        return nursery_top++;
+    }
+    int ret=gc_new_unit();
+    // nursery is full,value allocated in old space may point to young values before next minor collection
+    if(tracing)
+    {
+        ++gc_alloc_count;
+        if(gc_phase!=gc_phase_idle)
+            ++gc_step_alloc;
+        gc_write_barrier(ret);
+    }
+    return ret;
+}
+nasal_scalar& nasal_virtual_machine::gc_get(int value_address)
+{
+    if(0<=value_address && value_address<garbage_collector_memory.size() && !garbage_collector_memory[value_address]->collected)
+        return garbage_collector_memory[value_address]->elem;
+    return error_returned_value;
+}
+void nasal_virtual_machine::add_reference(int value_address)
+{
+    if(tracing)
+        return;
+    if(0<=value_address && value_address<garbage_collector_memory.size() && !garbage_collector_memory[value_address]->collected)
+        ++garbage_collector_memory[value_address]->ref_cnt;
+    return;
+}
+void nasal_virtual_machine::del_reference(int value_address)
+{
+    if(tracing)
+        return;
+    if(0<=value_address && value_address<(int)garbage_collector_memory.size() && !garbage_collector_memory[value_address]->collected && !garbage_collector_memory[value_address]->permanent)
+        --garbage_collector_memory[value_address]->ref_cnt;
+    else
+        return;
+    if(!garbage_collector_memory[value_address]->ref_cnt)
+    {
+        // large structures are freed in steps by gc_free_pending instead of a long cascade here
+        if(gc_step_budget)
+        {
+            pending_free.push_back(value_address);
+            return;
+        }
+        gc_count_free(garbage_collector_memory[value_address]->elem);
+        garbage_collector_memory[value_address]->collected=true;
+        scalar_free(garbage_collector_memory[value_address]->elem);
+        garbage_collector_free_space.push_back(value_address);
+    }
+    return;
 }
 
 #endif
\ No newline at end of file
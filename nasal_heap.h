@@ -0,0 +1,438 @@
+#ifndef __NASAL_HEAP_H__
+#define __NASAL_HEAP_H__
+
+/*
+    nasal_heap_analyzer reads heap snapshot written by nasal_virtual_machine::gc_dump
+    and reports values that retain the most memory and reference cycles.
+    retained size of a value is the size of everything that will be freed if this value is freed,
+    which is the size of its subtree in the dominator tree.
+*/
+class nasal_heap_analyzer
+{
+private:
+    struct heap_node
+    {
+        int addr;
+        int type;
+        int ref_cnt;
+        long long bytes;
+        long long retained;
+        std::vector<int> edges;          // index of nodes,-1 if the address is not in snapshot
+        std::vector<std::string> labels;
+        int parent;                      // parent in depth-first search tree
+        int label_index;                 // index of the edge from parent
+        int idom;
+        int post_order;
+        int scc;
+    };
+    int error;
+    bool tracing;
+    // nodes[0] is a virtual root pointing to all roots
+    std::vector<heap_node> nodes;
+    std::map<int,int> addr_index;
+    std::vector<int> rpo;                // reverse post order from virtual root
+    std::vector<std::vector<int> > cycles;
+    void die(std::string);
+    void add_roots(std::vector<int>&);
+    void dfs_order();
+    int  intersect(int,int);
+    void dominators();
+    void find_cycles();
+    std::string path(int);
+public:
+    nasal_heap_analyzer();
+    int  get_error();
+    void clear();
+    bool is_snapshot(std::string);// file can be opened and begins with the header of heap snapshot
+    bool load(std::string);
+    void analyze();
+    void report(int);
+};
+
+nasal_heap_analyzer::nasal_heap_analyzer()
+{
+    error=0;
+    tracing=true;
+    return;
+}
+int nasal_heap_analyzer::get_error()
+{
+    return error;
+}
+void nasal_heap_analyzer::die(std::string info)
+{
+    ++error;
+    std::cout<<">> [heap] "<<info<<".\n";
+    return;
+}
+void nasal_heap_analyzer::clear()
+{
+    error=0;
+    tracing=true;
+    nodes.clear();
+    addr_index.clear();
+    rpo.clear();
+    cycles.clear();
+    return;
+}
+bool nasal_heap_analyzer::is_snapshot(std::string filename)
+{
+    std::ifstream fin(filename.c_str());
+    std::string magic;
+    int version=0;
+    fin>>magic>>version;
+    return !fin.fail() && magic=="nasal-heap" && version==1;
+}
+bool nasal_heap_analyzer::load(std::string filename)
+{
+    clear();
+    std::ifstream fin(filename.c_str());
+    if(fin.fail())
+    {
+        die("cannot open file <\""+filename+"\">");
+        return false;
+    }
+    std::string magic,mode;
+    int version;
+    fin>>magic>>version>>mode;
+    if(magic!="nasal-heap" || version!=1)
+    {
+        die("<\""+filename+"\"> is not a heap snapshot");
+        return false;
+    }
+    tracing=(mode=="tracing");
+    nodes.push_back(heap_node());
+    std::vector<int> roots;
+    std::vector<std::vector<int> > edge_addr(1);
+    std::string tag;
+    while(fin>>tag)
+    {
+        if(tag=="r")
+        {
+            int addr;
+            fin>>addr;
+            roots.push_back(addr);
+            continue;
+        }
+        heap_node node;
+        int edge_cnt;
+        fin>>node.addr>>node.type>>node.ref_cnt>>node.bytes>>edge_cnt;
+        if(tag!="u" || fin.fail() || node.type<vm_nil || node.type>vm_hash)
+        {
+            die("broken snapshot");
+            return false;
+        }
+        edge_addr.push_back(std::vector<int>());
+        for(int i=0;i<edge_cnt;++i)
+        {
+            int addr,len;
+            fin>>addr>>len;
+            fin.get();
+            std::string label(len,'\0');
+            if(len)
+                fin.read(&label[0],len);
+            edge_addr.back().push_back(addr);
+            node.labels.push_back(label);
+        }
+        if(fin.fail())
+        {
+            die("broken snapshot");
+            return false;
+        }
+        addr_index[node.addr]=nodes.size();
+        nodes.push_back(node);
+    }
+    for(int i=1;i<(int)nodes.size();++i)
+        for(int j=0;j<(int)edge_addr[i].size();++j)
+        {
+            std::map<int,int>::iterator iter=addr_index.find(edge_addr[i][j]);
+            nodes[i].edges.push_back(iter==addr_index.end()? -1:iter->second);
+        }
+    add_roots(roots);
+    return true;
+}
+void nasal_heap_analyzer::add_roots(std::vector<int>& roots)
+{
+    heap_node& root=nodes[0];
+    root.addr=-1;
+    root.type=vm_nil;
+    root.ref_cnt=0;
+    root.bytes=0;
+    for(int i=0;i<(int)roots.size();++i)
+        if(addr_index.count(roots[i]))
+        {
+            root.edges.push_back(addr_index[roots[i]]);
+            root.labels.push_back("<root>");
+        }
+    if(tracing)
+        return;
+    // in reference counting mode,references that are not from heap come from runtime's stacks
+    // so values with more references than edges pointing to them are roots too
+    std::vector<int> in_degree(nodes.size(),0);
+    for(int i=1;i<(int)nodes.size();++i)
+        for(int j=0;j<(int)nodes[i].edges.size();++j)
+            if(nodes[i].edges[j]>0)
+                ++in_degree[nodes[i].edges[j]];
+    for(int i=1;i<(int)nodes.size();++i)
+        if(nodes[i].ref_cnt>in_degree[i])
+        {
+            root.edges.push_back(i);
+            root.labels.push_back("<extern>");
+        }
+    return;
+}
+void nasal_heap_analyzer::dfs_order()
+{
+    // iterative depth-first search,deep linked lists will not overflow the native stack
+    int size=nodes.size();
+    for(int i=0;i<size;++i)
+    {
+        nodes[i].parent=-1;
+        nodes[i].label_index=-1;
+        nodes[i].post_order=-1;
+    }
+    std::vector<int> visited(size,0);
+    std::vector<std::pair<int,int> > stack;
+    std::vector<int> post;
+    stack.push_back(std::pair<int,int>(0,0));
+    visited[0]=1;
+    while(!stack.empty())
+    {
+        int n=stack.back().first;
+        int& e=stack.back().second;
+        if(e<(int)nodes[n].edges.size())
+        {
+            int next=nodes[n].edges[e];
+            if(next>0 && !visited[next])
+            {
+                visited[next]=1;
+                nodes[next].parent=n;
+                nodes[next].label_index=e;
+                ++e;
+                stack.push_back(std::pair<int,int>(next,0));
+            }
+            else
+                ++e;
+            continue;
+        }
+        nodes[n].post_order=post.size();
+        post.push_back(n);
+        stack.pop_back();
+    }
+    rpo.assign(post.rbegin(),post.rend());
+    return;
+}
+int nasal_heap_analyzer::intersect(int a,int b)
+{
+    while(a!=b)
+    {
+        while(nodes[a].post_order<nodes[b].post_order)
+            a=nodes[a].idom;
+        while(nodes[b].post_order<nodes[a].post_order)
+            b=nodes[b].idom;
+    }
+    return a;
+}
+void nasal_heap_analyzer::dominators()
+{
+    // iterative algorithm by Cooper,Harvey and Kennedy
+    int size=nodes.size();
+    std::vector<std::vector<int> > preds(size);
+    for(int i=0;i<size;++i)
+    {
+        nodes[i].idom=-1;
+        if(nodes[i].post_order<0)
+            continue;
+        for(int j=0;j<(int)nodes[i].edges.size();++j)
+            if(nodes[i].edges[j]>0)
+                preds[nodes[i].edges[j]].push_back(i);
+    }
+    nodes[0].idom=0;
+    bool changed=true;
+    while(changed)
+    {
+        changed=false;
+        for(int i=1;i<(int)rpo.size();++i)
+        {
+            int n=rpo[i];
+            int new_idom=-1;
+            for(int j=0;j<(int)preds[n].size();++j)
+            {
+                int p=preds[n][j];
+                if(nodes[p].idom<0)
+                    continue;
+                new_idom=new_idom<0? p:intersect(p,new_idom);
+            }
+            if(new_idom!=nodes[n].idom)
+            {
+                nodes[n].idom=new_idom;
+                changed=true;
+            }
+        }
+    }
+    // dominator is always before the value in reverse post order
+    for(int i=0;i<size;++i)
+        nodes[i].retained=nodes[i].bytes;
+    for(int i=rpo.size()-1;i>0;--i)
+        nodes[nodes[rpo[i]].idom].retained+=nodes[rpo[i]].retained;
+    return;
+}
+void nasal_heap_analyzer::find_cycles()
+{
+    // iterative tarjan algorithm,strongly connected components with more than one value are cycles
+    int size=nodes.size();
+    std::vector<int> index(size,-1),low(size,0),on_stack(size,0);
+    std::vector<int> scc_stack;
+    std::vector<std::pair<int,int> > stack;
+    int counter=0;
+    for(int i=1;i<size;++i)
+        nodes[i].scc=-1;
+    for(int s=1;s<size;++s)
+    {
+        if(index[s]>=0)
+            continue;
+        stack.push_back(std::pair<int,int>(s,0));
+        index[s]=low[s]=counter++;
+        scc_stack.push_back(s);
+        on_stack[s]=1;
+        while(!stack.empty())
+        {
+            int n=stack.back().first;
+            int& e=stack.back().second;
+            if(e<(int)nodes[n].edges.size())
+            {
+                int next=nodes[n].edges[e++];
+                if(next<=0)
+                    continue;
+                if(index[next]<0)
+                {
+                    index[next]=low[next]=counter++;
+                    scc_stack.push_back(next);
+                    on_stack[next]=1;
+                    stack.push_back(std::pair<int,int>(next,0));
+                }
+                else if(on_stack[next] && index[next]<low[n])
+                    low[n]=index[next];
+                continue;
+            }
+            stack.pop_back();
+            if(!stack.empty() && low[n]<low[stack.back().first])
+                low[stack.back().first]=low[n];
+            if(low[n]!=index[n])
+                continue;
+            std::vector<int> component;
+            int top;
+            do
+            {
+                top=scc_stack.back();
+                scc_stack.pop_back();
+                on_stack[top]=0;
+                component.push_back(top);
+            }while(top!=n);
+            bool self_loop=false;
+            for(int j=0;j<(int)nodes[n].edges.size();++j)
+                if(nodes[n].edges[j]==n)
+                    self_loop=true;
+            if(component.size()>1 || self_loop)
+            {
+                for(int j=0;j<(int)component.size();++j)
+                    nodes[component[j]].scc=cycles.size();
+                cycles.push_back(component);
+            }
+        }
+    }
+    return;
+}
+std::string nasal_heap_analyzer::path(int n)
+{
+    // path is built from labels of edges in depth-first search tree,at most 8 labels are shown
+    if(n>0 && nodes[n].post_order<0)
+        return "<unreachable>";
+    std::vector<std::string> labels;
+    while(n>0)
+    {
+        labels.push_back(nodes[nodes[n].parent].labels[nodes[n].label_index]);
+        n=nodes[n].parent;
+    }
+    std::string ret=labels.size()>8? "...":"";
+    for(int i=(labels.size()>8? 7:(int)labels.size()-1);i>=0;--i)
+    {
+        std::string& label=labels[i];
+        if(ret.length() && ret!="..." && label[0]!='[' && label[0]!='<')
+            ret+='.';
+        ret+=label;
+    }
+    return ret;
+}
+void nasal_heap_analyzer::analyze()
+{
+    if(nodes.empty())
+        return;
+    dfs_order();
+    dominators();
+    find_cycles();
+    return;
+}
+void nasal_heap_analyzer::report(int top)
+{
+    const char* type_name[]={"nil","number","string","closure","function","vector","hash"};
+    if(nodes.empty())
+        return;
+    long long total_bytes=0,reachable_bytes=0;
+    int reachable=0;
+    for(int i=1;i<(int)nodes.size();++i)
+    {
+        total_bytes+=nodes[i].bytes;
+        if(nodes[i].post_order>=0)
+        {
+            ++reachable;
+            reachable_bytes+=nodes[i].bytes;
+        }
+    }
+    std::cout<<">> [heap] "<<nodes.size()-1<<" values("<<total_bytes<<" bytes),"<<reachable<<" reachable("<<reachable_bytes<<" bytes).\n";
+    if(reachable<(int)nodes.size()-1)
+        std::cout<<">> [heap] "<<nodes.size()-1-reachable<<" values("<<total_bytes-reachable_bytes<<" bytes) are unreachable"
+            <<(tracing? ",they will be freed by next collection.\n":",they are leaked by reference cycles.\n");
+
+    std::vector<std::pair<long long,int> > retainers;
+    for(int i=1;i<(int)nodes.size();++i)
+        if(nodes[i].post_order>=0)
+            retainers.push_back(std::pair<long long,int>(-nodes[i].retained,i));
+    std::sort(retainers.begin(),retainers.end());
+    std::cout<<">> [heap] top retainers:\n";
+    std::cout<<">> [heap]     retained        self  type      path\n";
+    for(int i=0;i<top && i<(int)retainers.size();++i)
+    {
+        heap_node& node=nodes[retainers[i].second];
+        std::cout<<">> [heap] ";
+        std::cout.width(12);
+        std::cout<<node.retained;
+        std::cout.width(12);
+        std::cout<<node.bytes<<"  ";
+        std::cout.width(10);
+        std::cout<<std::left<<type_name[node.type]<<std::right<<path(retainers[i].second)<<'\n';
+    }
+
+    std::vector<std::pair<long long,int> > cycle_size;
+    for(int i=0;i<(int)cycles.size();++i)
+    {
+        long long bytes=0;
+        for(int j=0;j<(int)cycles[i].size();++j)
+            bytes+=nodes[cycles[i][j]].bytes;
+        cycle_size.push_back(std::pair<long long,int>(-bytes,i));
+    }
+    std::sort(cycle_size.begin(),cycle_size.end());
+    std::cout<<">> [heap] "<<cycles.size()<<" reference cycle(s).\n";
+    for(int i=0;i<top && i<(int)cycle_size.size();++i)
+    {
+        std::vector<int>& cycle=cycles[cycle_size[i].second];
+        // the member closest to roots is shown as the entry of this cycle
+        int entry=cycle[0];
+        for(int j=1;j<(int)cycle.size();++j)
+            if(nodes[cycle[j]].post_order>nodes[entry].post_order)
+                entry=cycle[j];
+        std::cout<<">> [heap] "<<cycle.size()<<" values("<<-cycle_size[i].first<<" bytes) from "<<path(entry)<<'\n';
+    }
+    return;
+}
+#endif
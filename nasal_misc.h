@@ -17,7 +17,7 @@
 
 	if this string cannot be converted to a number,it will return nan
 */
-inline double hex_to_double(std::string str,int len)
+inline double hex_to_double(const char* str,int len)
 {
 	double ret=0,num_pow=1;
 	for(int i=len-1;i>1;--i)
@@ -34,7 +34,7 @@ inline double hex_to_double(std::string str,int len)
 	}
 	return ret;
 }
-inline double oct_to_double(std::string str,int len)
+inline double oct_to_double(const char* str,int len)
 {
 	double ret=0,num_pow=1;
 	for(int i=len-1;i>1;--i)
@@ -47,7 +47,7 @@ inline double oct_to_double(std::string str,int len)
 	}
 	return ret;
 }
-inline double dec_to_double(std::string str,int len)
+inline double dec_to_double(const char* str,int len)
 {
 	double ret=0;
 	int i=0;
@@ -98,20 +98,19 @@ inline double dec_to_double(std::string str,int len)
 	}
 	return ret;
 }
-double trans_string_to_number(std::string str)
+double trans_string_to_number(const std::string& source)
 {
+	// sign is skipped by moving the pointer,so the string is not copied
+	const char* str=source.c_str();
 	bool is_negative=false;
-	int len=str.length();
+	int len=source.length();
 	double ret_num=0;
 	if(!len)
 		return (1/0.0)+(-1/0.0);
 	if(str[0]=='-' || str[0]=='+')
 	{
 		is_negative=(str[0]=='-');
-		std::string tmp="";
-		for(int i=1;i<len;++i)
-			tmp.push_back(str[i]);
-		str=tmp;
+		++str;
 		--len;
 		if(!len)
 			return (1/0.0)+(-1/0.0);
@@ -0,0 +1,340 @@
+#ifndef __NASAL_OPTIMIZER_H__
+#define __NASAL_OPTIMIZER_H__
+
+/*
+nasal_optimizer: works on ast between nasal_import::link and nasal_codegen::main_progress
+constant calculations are folded with the same rules as nasal_bytecode_vm,
+branches that never run and statements that do nothing are removed,
+and !!x is replaced by x if x is 0 or 1 already
+*/
+class nasal_optimizer
+{
+private:
+    bool is_const(nasal_ast&);
+    bool is_bool(nasal_ast&);
+    bool const_condition(nasal_ast&,bool&);
+    double const_to_number(nasal_ast&);
+    void const_number(nasal_ast&,double);
+    void const_string(nasal_ast&,std::string);
+    void const_nil(nasal_ast&);
+    void calculation_fold(nasal_ast&);
+    void add_statement(std::vector<nasal_ast>&,nasal_ast&);
+    void block_fold(nasal_ast&);
+    void optimize(nasal_ast&);
+public:
+    void do_optimization(nasal_ast&);
+};
+
+bool nasal_optimizer::is_const(nasal_ast& node)
+{
+    int type=node.get_type();
+    return type==ast_number || type==ast_string;
+}
+
+bool nasal_optimizer::is_bool(nasal_ast& node)
+{
+    // these calculations only give 0 or 1
+    switch(node.get_type())
+    {
+        case ast_unary_not:
+        case ast_cmp_equal:
+        case ast_cmp_not_equal:
+        case ast_less_than:
+        case ast_less_equal:
+        case ast_greater_than:
+        case ast_greater_equal:return true;
+    }
+    return false;
+}
+
+bool nasal_optimizer::const_condition(nasal_ast& node,bool& result)
+{
+    // same as nasal_bytecode_vm::check_condition
+    int type=node.get_type();
+    if(type==ast_nil)
+        result=false;
+    else if(type==ast_number)
+        result=(node.get_num()!=0);
+    else if(type==ast_string)
+    {
+        std::string str=node.get_str();
+        double number=trans_string_to_number(str);
+        result=std::isnan(number)? (str.length()!=0):(number!=0);
+    }
+    else
+        return false;
+    return true;
+}
+
+double nasal_optimizer::const_to_number(nasal_ast& node)
+{
+    if(node.get_type()==ast_number)
+        return node.get_num();
+    return trans_string_to_number(node.get_str());
+}
+
+void nasal_optimizer::const_number(nasal_ast& node,double num)
+{
+    node.get_children().clear();
+    node.set_type(ast_number);
+    node.set_num(num);
+    return;
+}
+
+void nasal_optimizer::const_string(nasal_ast& node,std::string str)
+{
+    node.get_children().clear();
+    node.set_type(ast_string);
+    node.set_str(str);
+    return;
+}
+
+void nasal_optimizer::const_nil(nasal_ast& node)
+{
+    node.get_children().clear();
+    node.set_type(ast_nil);
+    return;
+}
+
+void nasal_optimizer::calculation_fold(nasal_ast& node)
+{
+    // children are folded before this node
+    std::vector<nasal_ast>& children=node.get_children();
+    int type=node.get_type();
+    bool cond;
+    switch(type)
+    {
+        case ast_unary_sub:
+            if(is_const(children[0]))
+                const_number(node,-const_to_number(children[0]));
+            break;
+        case ast_unary_not:
+            if(const_condition(children[0],cond))
+                const_number(node,(double)!cond);
+            else if(children[0].get_type()==ast_unary_not && is_bool(children[0].get_children()[0]))
+            {
+                nasal_ast tmp=children[0].get_children()[0];
+                node=tmp;
+            }
+            break;
+        case ast_add:
+        case ast_sub:
+        case ast_mult:
+        case ast_div:
+            if(is_const(children[0]) && is_const(children[1]))
+            {
+                double num1=const_to_number(children[0]);
+                double num2=const_to_number(children[1]);
+                switch(type)
+                {
+                    case ast_add: const_number(node,num1+num2);break;
+                    case ast_sub: const_number(node,num1-num2);break;
+                    case ast_mult:const_number(node,num1*num2);break;
+                    case ast_div: const_number(node,num1/num2);break;
+                }
+            }
+            break;
+        case ast_link:
+            if(is_const(children[0]) && is_const(children[1]))
+            {
+                std::string str1=children[0].get_type()==ast_string? children[0].get_str():trans_number_to_string(children[0].get_num());
+                std::string str2=children[1].get_type()==ast_string? children[1].get_str():trans_number_to_string(children[1].get_num());
+                const_string(node,str1+str2);
+            }
+            break;
+        case ast_cmp_equal:
+        case ast_cmp_not_equal:
+        {
+            // same as nasal_bytecode_vm::ref_equal
+            int type1=children[0].get_type();
+            int type2=children[1].get_type();
+            bool equal;
+            if(type1==ast_nil && type2==ast_nil)
+                equal=true;
+            else if(type1==ast_string && type2==ast_string)
+                equal=(children[0].get_str()==children[1].get_str());
+            else if(is_const(children[0]) && is_const(children[1]))
+                equal=(const_to_number(children[0])==const_to_number(children[1]));
+            else if((type1==ast_nil && is_const(children[1])) || (is_const(children[0]) && type2==ast_nil))
+                equal=false;
+            else
+                break;
+            const_number(node,(double)(type==ast_cmp_equal? equal:!equal));
+            break;
+        }
+        case ast_less_than:
+        case ast_less_equal:
+        case ast_greater_than:
+        case ast_greater_equal:
+            if(children[0].get_type()==ast_string && children[1].get_type()==ast_string)
+            {
+                std::string str1=children[0].get_str();
+                std::string str2=children[1].get_str();
+                switch(type)
+                {
+                    case ast_less_than:    const_number(node,(double)(str1<str2));break;
+                    case ast_less_equal:   const_number(node,(double)(str1<=str2));break;
+                    case ast_greater_than: const_number(node,(double)(str1>str2));break;
+                    case ast_greater_equal:const_number(node,(double)(str1>=str2));break;
+                }
+            }
+            else if(is_const(children[0]) && is_const(children[1]))
+            {
+                double num1=const_to_number(children[0]);
+                double num2=const_to_number(children[1]);
+                switch(type)
+                {
+                    case ast_less_than:    const_number(node,(double)(num1<num2));break;
+                    case ast_less_equal:   const_number(node,(double)(num1<=num2));break;
+                    case ast_greater_than: const_number(node,(double)(num1>num2));break;
+                    case ast_greater_equal:const_number(node,(double)(num1>=num2));break;
+                }
+            }
+            break;
+        case ast_trinocular:
+            if(const_condition(children[0],cond))
+            {
+                nasal_ast tmp=children[cond? 1:2];
+                node=tmp;
+            }
+            break;
+        case ast_and:
+            // a and b gives b if both are true,otherwise nil
+            if(const_condition(children[0],cond))
+            {
+                if(!cond)
+                    const_nil(node);
+                else if(const_condition(children[1],cond))
+                {
+                    if(cond)
+                    {
+                        nasal_ast tmp=children[1];
+                        node=tmp;
+                    }
+                    else
+                        const_nil(node);
+                }
+            }
+            break;
+        case ast_or:
+            // a or b gives the first true value,otherwise nil
+            if(const_condition(children[0],cond))
+            {
+                if(cond)
+                {
+                    nasal_ast tmp=children[0];
+                    node=tmp;
+                }
+                else if(const_condition(children[1],cond))
+                {
+                    if(cond)
+                    {
+                        nasal_ast tmp=children[1];
+                        node=tmp;
+                    }
+                    else
+                        const_nil(node);
+                }
+            }
+            break;
+    }
+    return;
+}
+
+void nasal_optimizer::add_statement(std::vector<nasal_ast>& statements,nasal_ast& node)
+{
+    bool cond;
+    std::vector<nasal_ast>& children=node.get_children();
+    switch(node.get_type())
+    {
+        // these statements do nothing
+        case ast_null:
+        case ast_nil:
+        case ast_number:
+        case ast_string:
+        case ast_function:break;
+        case ast_conditional:
+        {
+            // branches after a true condition never run
+            std::vector<nasal_ast> branches;
+            for(int i=0;i<(int)children.size();++i)
+            {
+                nasal_ast& tmp=children[i];
+                if(tmp.get_type()==ast_else)
+                {
+                    branches.push_back(tmp);
+                    break;
+                }
+                if(!const_condition(tmp.get_children()[0],cond))
+                    branches.push_back(tmp);
+                else if(cond)
+                {
+                    nasal_ast else_node;
+                    else_node.set_line(tmp.get_line());
+                    else_node.set_type(ast_else);
+                    else_node.add_child(tmp.get_children()[1]);
+                    branches.push_back(else_node);
+                    break;
+                }
+            }
+            if(branches.empty())
+                break;
+            if(branches[0].get_type()==ast_else)
+            {
+                // block of the only branch runs in the same scope,so it is moved to outside
+                std::vector<nasal_ast>& block=branches[0].get_children()[0].get_children();
+                for(int i=0;i<(int)block.size();++i)
+                    add_statement(statements,block[i]);
+                break;
+            }
+            branches[0].set_type(ast_if);
+            children=branches;
+            statements.push_back(node);
+            break;
+        }
+        case ast_while:
+            if(!const_condition(children[0],cond) || cond)
+                statements.push_back(node);
+            break;
+        case ast_for:
+            // for(init;cond;step) only runs init if cond is false
+            if(children[1].get_type()!=ast_null && const_condition(children[1],cond) && !cond)
+                add_statement(statements,children[0]);
+            else
+                statements.push_back(node);
+            break;
+        default:statements.push_back(node);break;
+    }
+    return;
+}
+
+void nasal_optimizer::block_fold(nasal_ast& node)
+{
+    std::vector<nasal_ast> statements;
+    std::vector<nasal_ast>& children=node.get_children();
+    for(int i=0;i<(int)children.size();++i)
+        add_statement(statements,children[i]);
+    children=statements;
+    return;
+}
+
+void nasal_optimizer::optimize(nasal_ast& node)
+{
+    std::vector<nasal_ast>& children=node.get_children();
+    for(int i=0;i<(int)children.size();++i)
+        optimize(children[i]);
+    int type=node.get_type();
+    if(type==ast_root || type==ast_block)
+        block_fold(node);
+    else
+        calculation_fold(node);
+    return;
+}
+
+void nasal_optimizer::do_optimization(nasal_ast& root)
+{
+    optimize(root);
+    return;
+}
+
+#endif
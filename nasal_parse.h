@@ -837,7 +837,7 @@ nasal_ast nasal_parse::cmp_expr()
         int type2=tmp.get_children()[1].get_type();
         if(type1==ast_nil && type2==ast_nil)
         {
-            double num;
+            double num=0;
             switch(tmp.get_type())
             {
                 case ast_cmp_equal:num=1;break;
@@ -865,7 +865,7 @@ nasal_ast nasal_parse::cmp_expr()
         }
         else if(type1==ast_number && type2==ast_number)
         {
-            double num;
+            double num=0;
             double num1=tmp.get_children()[0].get_num();
             double num2=tmp.get_children()[1].get_num();
             switch(tmp.get_type())
@@ -883,7 +883,7 @@ nasal_ast nasal_parse::cmp_expr()
         }
         else if(type1==ast_number && type2==ast_string)
         {
-            double num;
+            double num=0;
             double num1=tmp.get_children()[0].get_num();
             double num2=trans_string_to_number(tmp.get_children()[1].get_str());
             if(std::isnan(num2))
@@ -903,7 +903,7 @@ nasal_ast nasal_parse::cmp_expr()
         }
         else if(type1==ast_string && type2==ast_number)
         {
-            double num;
+            double num=0;
             double num1=trans_string_to_number(tmp.get_children()[0].get_str());
             double num2=tmp.get_children()[1].get_num();
             if(std::isnan(num2))
@@ -923,7 +923,7 @@ nasal_ast nasal_parse::cmp_expr()
         }
         else if(type1==ast_string && type2==ast_string)
         {
-            double num;
+            double num=0;
             std::string str1=tmp.get_children()[0].get_str();
             std::string str2=tmp.get_children()[1].get_str();
             switch(tmp.get_type())
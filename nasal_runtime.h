@@ -56,9 +56,10 @@ private:
     int call_function(nasal_ast&,int,int,int);
     int call_builtin_function(std::string,int);
     // get scalars' memory place in complex data structure like vector/hash/function/closure(scope)
-    int call_scalar_mem(nasal_ast&,int);
-    int call_vector_mem(nasal_ast&,int,int);
-    int call_hash_mem(nasal_ast&,int,int);
+    int* call_scalar_mem(nasal_ast&,int);
+    int* call_vector_mem(nasal_ast&,int*,int);
+    int* call_hash_mem(nasal_ast&,int*,int);
+    void change_mem(nasal_ast&,int,int);
     // calculate scalars
     int nasal_scalar_add(int,int);
     int nasal_scalar_sub(int,int);
@@ -83,6 +84,7 @@ public:
     nasal_runtime();
     ~nasal_runtime();
     void set_root(nasal_ast&);
+    void set_gc_step_budget(int);
     void run();
 };
 
@@ -119,6 +121,11 @@ void nasal_runtime::set_root(nasal_ast& parse_result)
     this->root=parse_result;
     return;
 }
+void nasal_runtime::set_gc_step_budget(int budget)
+{
+    nasal_vm.set_gc_step_budget(budget);
+    return;
+}
 void nasal_runtime::run()
 {
     // this state is reserved for builtin_die
@@ -337,37 +344,40 @@ int nasal_runtime::loop_progress(nasal_ast& node,int local_scope_addr)
             return rt_error;
         }
         // begin loop progress
-        int mem_addr=-1;
         if(iter_node.get_type()==ast_new_iter)
         {
             int new_value_addr=nasal_vm.gc_alloc(vm_nil);
             std::string val_name=iter_node.get_children()[0].get_str();
             nasal_vm.gc_get(local_scope_addr<0? global_scope_address:local_scope_addr).get_closure().add_new_value(val_name,new_value_addr);
-            mem_addr=nasal_vm.gc_get(local_scope_addr<0? global_scope_address:local_scope_addr).get_closure().get_mem_address(val_name);
-        }
-        else
-            mem_addr=call_scalar_mem(iter_node,local_scope_addr);
-        if(mem_addr<0)
-        {
-            die(iter_node.get_line(),"get null iterator");
-            return rt_error;
         }
         // ref_vector's size may change when running,so this loop will check size each time
         nasal_vector& ref_vector=nasal_vm.gc_get(vector_value_addr).get_vector();
         for(int i=0;i<ref_vector.size();++i)
         {
+            // slot of iterator may be invalid after running the block,so get it in each loop
+            int* mem_addr=NULL;
+            if(iter_node.get_type()==ast_new_iter)
+                mem_addr=nasal_vm.gc_get(local_scope_addr<0? global_scope_address:local_scope_addr).get_closure().get_mem_address(iter_node.get_children()[0].get_str());
+            else
+                mem_addr=call_scalar_mem(iter_node,local_scope_addr);
+            if(!mem_addr)
+            {
+                die(iter_node.get_line(),"get null iterator");
+                return rt_error;
+            }
             // update iterator
+            nasal_vm.del_reference(*mem_addr);
             if(loop_type==ast_forindex)
             {
                 int new_iter_val_addr=nasal_vm.gc_alloc(vm_number);
                 nasal_vm.gc_get(new_iter_val_addr).set_number((double)i);
-                nasal_vm.mem_change(mem_addr,new_iter_val_addr);
+                *mem_addr=new_iter_val_addr;
             }
             else
             {
                 int value_addr=ref_vector.get_value_address(i);
                 nasal_vm.add_reference(value_addr);
-                nasal_vm.mem_change(mem_addr,value_addr);
+                *mem_addr=value_addr;
             }
             ret_state=block_progress(run_block_node,local_scope_addr);
             if(ret_state==rt_break || ret_state==rt_return || error)
@@ -923,37 +933,37 @@ int nasal_runtime::call_builtin_function(std::string val_name,int local_scope_ad
     }
     return ret_value_addr;
 }
-int nasal_runtime::call_scalar_mem(nasal_ast& node,int local_scope_addr)
+int* nasal_runtime::call_scalar_mem(nasal_ast& node,int local_scope_addr)
 {
-    int mem_address=-1;
+    int* mem_address=NULL;
     if(node.get_type()==ast_identifier)
     {
         std::string id_name=node.get_str();
         if(local_scope_addr>=0)
             mem_address=nasal_vm.gc_get(local_scope_addr).get_closure().get_mem_address(id_name);
-        if(mem_address<0)
+        if(!mem_address)
             mem_address=nasal_vm.gc_get(global_scope_address).get_closure().get_mem_address(id_name);
-        if(mem_address<0)
+        if(!mem_address)
         {
             die(node.get_line(),"cannot find \""+id_name+"\"");
-            return -1;
+            return NULL;
         }
         return mem_address;
     }
     std::string id_name=node.get_children()[0].get_str();
     if(local_scope_addr>=0)
         mem_address=nasal_vm.gc_get(local_scope_addr).get_closure().get_mem_address(id_name);
-    if(mem_address<0)
+    if(!mem_address)
         mem_address=nasal_vm.gc_get(global_scope_address).get_closure().get_mem_address(id_name);
-    if(mem_address<0)
+    if(!mem_address)
     {
         die(node.get_children()[0].get_line(),"cannot find \""+id_name+"\"");
-        return -1;
+        return NULL;
     }
     int call_expr_size=node.get_children().size();
     for(int i=1;i<call_expr_size;++i)
     {
-        int tmp_mem_addr=-1;
+        int* tmp_mem_addr=NULL;
         nasal_ast& call_expr=node.get_children()[i];
         switch(call_expr.get_type())
         {
@@ -961,7 +971,7 @@ int nasal_runtime::call_scalar_mem(nasal_ast& node,int local_scope_addr)
             case ast_call_hash: tmp_mem_addr=call_hash_mem(call_expr,mem_address,local_scope_addr);break;
         }
         mem_address=tmp_mem_addr;
-        if(mem_address<0)
+        if(!mem_address)
         {
             die(call_expr.get_line(),"incorrect memory space");
             break;
@@ -969,15 +979,15 @@ int nasal_runtime::call_scalar_mem(nasal_ast& node,int local_scope_addr)
     }
     return mem_address;
 }
-int nasal_runtime::call_vector_mem(nasal_ast& node,int base_mem_addr,int local_scope_addr)
+int* nasal_runtime::call_vector_mem(nasal_ast& node,int* base_mem_addr,int local_scope_addr)
 {
-    int return_mem_addr=-1;
-    int base_value_addr=nasal_vm.mem_get(base_mem_addr);
+    int* return_mem_addr=NULL;
+    int base_value_addr=*base_mem_addr;
     int base_value_type=nasal_vm.gc_get(base_value_addr).get_type();
     if(base_value_type!=vm_vector && base_value_type!=vm_hash)
     {
         die(node.get_line(),"incorrect value type,must be vector/hash");
-        return -1;
+        return NULL;
     }
     if(base_value_type==vm_vector)
     {
@@ -988,7 +998,7 @@ int nasal_runtime::call_vector_mem(nasal_ast& node,int base_mem_addr,int local_s
         if(index_value_type!=vm_number && index_value_type!=vm_string)
         {
             die(tmp.get_line(),"index is not a number/numerable string");
-            return -1;
+            return NULL;
         }
         int index_num=0;
         if(index_value_type==vm_string)
@@ -1009,31 +1019,44 @@ int nasal_runtime::call_vector_mem(nasal_ast& node,int base_mem_addr,int local_s
         if(str_addr<0 || nasal_vm.gc_get(str_addr).get_type()!=vm_string)
         {
             die(tmp.get_line(),"must use string as the key");
-            return -1;
+            return NULL;
         }
         std::string str=nasal_vm.gc_get(str_addr).get_string();
         return_mem_addr=nasal_vm.gc_get(base_value_addr).get_hash().get_mem_address(str);
     }
     return return_mem_addr;
 }
-int nasal_runtime::call_hash_mem(nasal_ast& node,int base_mem_addr,int local_scope_addr)
+int* nasal_runtime::call_hash_mem(nasal_ast& node,int* base_mem_addr,int local_scope_addr)
 {
-    int base_value_addr=nasal_vm.mem_get(base_mem_addr);
+    int base_value_addr=*base_mem_addr;
     int value_type=nasal_vm.gc_get(base_value_addr).get_type();
     if(value_type!=vm_hash)
     {
         die(node.get_line(),"called a value that is not a hash");
-        return -1;
+        return NULL;
     }
     nasal_hash& ref=nasal_vm.gc_get(base_value_addr).get_hash();
-    int ret_mem_addr=ref.get_mem_address(node.get_str());
-    if(ret_mem_addr<0)
+    int* ret_mem_addr=ref.get_mem_address(node.get_str());
+    if(!ret_mem_addr)
     {
         ref.add_elem(node.get_str(),nasal_vm.gc_alloc(vm_nil));
         ret_mem_addr=ref.get_mem_address(node.get_str());
     }
     return ret_mem_addr;
 }
+void nasal_runtime::change_mem(nasal_ast& node,int value_addr,int local_scope_addr)
+{
+    // the reference of value_addr is moved to the slot
+    int* mem_addr=call_scalar_mem(node,local_scope_addr);
+    if(!mem_addr)
+    {
+        nasal_vm.del_reference(value_addr);
+        return;
+    }
+    nasal_vm.del_reference(*mem_addr);
+    *mem_addr=value_addr;
+    return;
+}
 int nasal_runtime::nasal_scalar_add(int a_scalar_addr,int b_scalar_addr)
 {
     if(a_scalar_addr<0 || b_scalar_addr<0)
@@ -1158,12 +1181,11 @@ int nasal_runtime::nasal_scalar_link(int a_scalar_addr,int b_scalar_addr)
         std::cout<<">> [vm] scalar_link: error value type.\n";
         return -1;
     }
-    std::string a_str;
-    std::string b_str;
-    a_str=(a_ref_type==vm_number)? trans_number_to_string(a_ref.get_number()):a_ref.get_string();
-    b_str=(b_ref_type==vm_number)? trans_number_to_string(b_ref.get_number()):b_ref.get_string();
+    std::string b_str=(b_ref_type==vm_number)? trans_number_to_string(b_ref.get_number()):b_ref.get_string();
+    if(a_ref_type==vm_string)
+        return nasal_vm.gc_link(a_scalar_addr,b_str);
     int new_value_address=nasal_vm.gc_alloc(vm_string);
-    nasal_vm.gc_get(new_value_address).set_string(a_str+b_str);
+    nasal_vm.gc_get(new_value_address).set_string(trans_number_to_string(a_ref.get_number())+b_str);
     return new_value_address;
 }
 int nasal_runtime::nasal_scalar_unary_sub(int a_scalar_addr)
@@ -1252,8 +1274,8 @@ int nasal_runtime::nasal_scalar_cmp_equal(int a_scalar_addr,int b_scalar_addr)
     {
         if(a_ref_type==vm_string && b_ref_type==vm_string)
         {
-            std::string astr=a_ref.get_string();
-            std::string bstr=b_ref.get_string();
+            const std::string& astr=a_ref.get_string();
+            const std::string& bstr=b_ref.get_string();
             int new_value_address=nasal_vm.gc_alloc(vm_number);
             nasal_vm.gc_get(new_value_address).set_number((double)(astr==bstr));
             return new_value_address;
@@ -1308,8 +1330,8 @@ int nasal_runtime::nasal_scalar_cmp_not_equal(int a_scalar_addr,int b_scalar_add
     {
         if(a_ref_type==vm_string && b_ref_type==vm_string)
         {
-            std::string astr=a_ref.get_string();
-            std::string bstr=b_ref.get_string();
+            const std::string& astr=a_ref.get_string();
+            const std::string& bstr=b_ref.get_string();
             int new_value_address=nasal_vm.gc_alloc(vm_number);
             nasal_vm.gc_get(new_value_address).set_number((double)(astr!=bstr));
             return new_value_address;
@@ -1351,8 +1373,8 @@ int nasal_runtime::nasal_scalar_cmp_less(int a_scalar_addr,int b_scalar_addr)
     int b_ref_type=b_ref.get_type();
     if(a_ref_type==vm_string && b_ref_type==vm_string)
     {
-        std::string a_str=a_ref.get_string();
-        std::string b_str=b_ref.get_string();
+        const std::string& a_str=a_ref.get_string();
+        const std::string& b_str=b_ref.get_string();
         int new_value_address=nasal_vm.gc_alloc(vm_number);
         nasal_vm.gc_get(new_value_address).set_number((double)(a_str<b_str));
         return new_value_address;
@@ -1386,8 +1408,8 @@ int nasal_runtime::nasal_scalar_cmp_greater(int a_scalar_addr,int b_scalar_addr)
     int b_ref_type=b_ref.get_type();
     if(a_ref_type==vm_string && b_ref_type==vm_string)
     {
-        std::string a_str=a_ref.get_string();
-        std::string b_str=b_ref.get_string();
+        const std::string& a_str=a_ref.get_string();
+        const std::string& b_str=b_ref.get_string();
         int new_value_address=nasal_vm.gc_alloc(vm_number);
         nasal_vm.gc_get(new_value_address).set_number((double)(a_str>b_str));
         return new_value_address;
@@ -1421,8 +1443,8 @@ int nasal_runtime::nasal_scalar_cmp_less_or_equal(int a_scalar_addr,int b_scalar
     int b_ref_type=b_ref.get_type();
     if(a_ref_type==vm_string && b_ref_type==vm_string)
     {
-        std::string a_str=a_ref.get_string();
-        std::string b_str=b_ref.get_string();
+        const std::string& a_str=a_ref.get_string();
+        const std::string& b_str=b_ref.get_string();
         int new_value_address=nasal_vm.gc_alloc(vm_number);
         nasal_vm.gc_get(new_value_address).set_number((double)(a_str<=b_str));
         return new_value_address;
@@ -1456,8 +1478,8 @@ int nasal_runtime::nasal_scalar_cmp_greater_or_equal(int a_scalar_addr,int b_sca
     int b_ref_type=b_ref.get_type();
     if(a_ref_type==vm_string && b_ref_type==vm_string)
     {
-        std::string a_str=a_ref.get_string();
-        std::string b_str=b_ref.get_string();
+        const std::string& a_str=a_ref.get_string();
+        const std::string& b_str=b_ref.get_string();
         int new_value_address=nasal_vm.gc_alloc(vm_number);
         nasal_vm.gc_get(new_value_address).set_number((double)(a_str>=b_str));
         return new_value_address;
@@ -1693,65 +1715,80 @@ int nasal_runtime::calculation(nasal_ast& node,int local_scope_addr)
     }
     else if(calculation_type==ast_equal)
     {
-        int scalar_mem_space=call_scalar_mem(node.get_children()[0],local_scope_addr);
+        // value is calculated before getting the slot,because calculation may change the container of this slot
         int new_scalar_gc_addr=calculation(node.get_children()[1],local_scope_addr);
-        nasal_vm.mem_change(scalar_mem_space,new_scalar_gc_addr);// this progress will delete the reference to old gc_addr in scalar_mem_space
         nasal_vm.add_reference(new_scalar_gc_addr);// this reference is reserved for ret_address
+        change_mem(node.get_children()[0],new_scalar_gc_addr,local_scope_addr);
         ret_address=new_scalar_gc_addr;
     }
     else if(calculation_type==ast_add_equal)
     {
-        int scalar_mem_space=call_scalar_mem(node.get_children()[0],local_scope_addr);
-        int scalar_val_space=nasal_vm.mem_get(scalar_mem_space);
         int new_scalar_gc_addr=calculation(node.get_children()[1],local_scope_addr);
-        int result_val_address=nasal_scalar_add(scalar_val_space,new_scalar_gc_addr);
+        int* scalar_mem_space=call_scalar_mem(node.get_children()[0],local_scope_addr);
+        int result_val_address=nasal_scalar_add(scalar_mem_space? *scalar_mem_space:-1,new_scalar_gc_addr);
         nasal_vm.del_reference(new_scalar_gc_addr);
-        nasal_vm.mem_change(scalar_mem_space,result_val_address);// this progress will delete the reference to old gc_addr in scalar_mem_space
-        nasal_vm.add_reference(result_val_address);// this reference is reserved for ret_address
+        if(scalar_mem_space)
+        {
+            nasal_vm.del_reference(*scalar_mem_space);
+            *scalar_mem_space=result_val_address;
+            nasal_vm.add_reference(result_val_address);// this reference is reserved for ret_address
+        }
         ret_address=result_val_address;
     }
     else if(calculation_type==ast_sub_equal)
     {
-        int scalar_mem_space=call_scalar_mem(node.get_children()[0],local_scope_addr);
-        int scalar_val_space=nasal_vm.mem_get(scalar_mem_space);
         int new_scalar_gc_addr=calculation(node.get_children()[1],local_scope_addr);
-        int result_val_address=nasal_scalar_sub(scalar_val_space,new_scalar_gc_addr);
+        int* scalar_mem_space=call_scalar_mem(node.get_children()[0],local_scope_addr);
+        int result_val_address=nasal_scalar_sub(scalar_mem_space? *scalar_mem_space:-1,new_scalar_gc_addr);
         nasal_vm.del_reference(new_scalar_gc_addr);
-        nasal_vm.mem_change(scalar_mem_space,result_val_address);// this progress will delete the reference to old gc_addr in scalar_mem_space
-        nasal_vm.add_reference(result_val_address);// this reference is reserved for ret_address
+        if(scalar_mem_space)
+        {
+            nasal_vm.del_reference(*scalar_mem_space);
+            *scalar_mem_space=result_val_address;
+            nasal_vm.add_reference(result_val_address);// this reference is reserved for ret_address
+        }
         ret_address=result_val_address;
     }
     else if(calculation_type==ast_div_equal)
     {
-        int scalar_mem_space=call_scalar_mem(node.get_children()[0],local_scope_addr);
-        int scalar_val_space=nasal_vm.mem_get(scalar_mem_space);
         int new_scalar_gc_addr=calculation(node.get_children()[1],local_scope_addr);
-        int result_val_address=nasal_scalar_div(scalar_val_space,new_scalar_gc_addr);
+        int* scalar_mem_space=call_scalar_mem(node.get_children()[0],local_scope_addr);
+        int result_val_address=nasal_scalar_div(scalar_mem_space? *scalar_mem_space:-1,new_scalar_gc_addr);
         nasal_vm.del_reference(new_scalar_gc_addr);
-        nasal_vm.mem_change(scalar_mem_space,result_val_address);// this progress will delete the reference to old gc_addr in scalar_mem_space
-        nasal_vm.add_reference(result_val_address);// this reference is reserved for ret_address
+        if(scalar_mem_space)
+        {
+            nasal_vm.del_reference(*scalar_mem_space);
+            *scalar_mem_space=result_val_address;
+            nasal_vm.add_reference(result_val_address);// this reference is reserved for ret_address
+        }
         ret_address=result_val_address;
     }
     else if(calculation_type==ast_mult_equal)
     {
-        int scalar_mem_space=call_scalar_mem(node.get_children()[0],local_scope_addr);
-        int scalar_val_space=nasal_vm.mem_get(scalar_mem_space);
         int new_scalar_gc_addr=calculation(node.get_children()[1],local_scope_addr);
-        int result_val_address=nasal_scalar_mult(scalar_val_space,new_scalar_gc_addr);
+        int* scalar_mem_space=call_scalar_mem(node.get_children()[0],local_scope_addr);
+        int result_val_address=nasal_scalar_mult(scalar_mem_space? *scalar_mem_space:-1,new_scalar_gc_addr);
         nasal_vm.del_reference(new_scalar_gc_addr);
-        nasal_vm.mem_change(scalar_mem_space,result_val_address);// this progress will delete the reference to old gc_addr in scalar_mem_space
-        nasal_vm.add_reference(result_val_address);// this reference is reserved for ret_address
+        if(scalar_mem_space)
+        {
+            nasal_vm.del_reference(*scalar_mem_space);
+            *scalar_mem_space=result_val_address;
+            nasal_vm.add_reference(result_val_address);// this reference is reserved for ret_address
+        }
         ret_address=result_val_address;
     }
     else if(calculation_type==ast_link_equal)
     {
-        int scalar_mem_space=call_scalar_mem(node.get_children()[0],local_scope_addr);
-        int scalar_val_space=nasal_vm.mem_get(scalar_mem_space);
         int new_scalar_gc_addr=calculation(node.get_children()[1],local_scope_addr);
-        int result_val_address=nasal_scalar_link(scalar_val_space,new_scalar_gc_addr);
+        int* scalar_mem_space=call_scalar_mem(node.get_children()[0],local_scope_addr);
+        int result_val_address=nasal_scalar_link(scalar_mem_space? *scalar_mem_space:-1,new_scalar_gc_addr);
         nasal_vm.del_reference(new_scalar_gc_addr);
-        nasal_vm.mem_change(scalar_mem_space,result_val_address);// this progress will delete the reference to old gc_addr in scalar_mem_space
-        nasal_vm.add_reference(result_val_address);// this reference is reserved for ret_address
+        if(scalar_mem_space)
+        {
+            nasal_vm.del_reference(*scalar_mem_space);
+            *scalar_mem_space=result_val_address;
+            nasal_vm.add_reference(result_val_address);// this reference is reserved for ret_address
+        }
         ret_address=result_val_address;
     }
     else
@@ -1818,13 +1855,7 @@ void nasal_runtime::multi_assignment(nasal_ast& node,int local_scope_addr)
 {
     nasal_ast& multi_call_node=node.get_children()[0];
     nasal_ast& value_node=node.get_children()[1];
-    std::vector<int> mem_table;
     int id_size=multi_call_node.get_children().size();
-    for(int i=0;i<id_size;++i)
-    {
-        nasal_ast& tmp_node=multi_call_node.get_children()[i];
-        mem_table.push_back(call_scalar_mem(tmp_node,local_scope_addr));
-    }
     if(value_node.get_type()==ast_multi_scalar)
     {
         // there's no need to check value_size==id_size
@@ -1833,7 +1864,7 @@ void nasal_runtime::multi_assignment(nasal_ast& node,int local_scope_addr)
         for(int i=0;i<id_size;++i)
             value_table.push_back(calculation(value_node.get_children()[i],local_scope_addr));
         for(int i=0;i<id_size;++i)
-            nasal_vm.mem_change(mem_table[i],value_table[i]);
+            change_mem(multi_call_node.get_children()[i],value_table[i],local_scope_addr);
     }
     else
     {
@@ -1859,7 +1890,7 @@ void nasal_runtime::multi_assignment(nasal_ast& node,int local_scope_addr)
             value_table.push_back(tmp_addr);
         }
         for(int i=0;i<id_size;++i)
-            nasal_vm.mem_change(mem_table[i],value_table[i]);
+            change_mem(multi_call_node.get_children()[i],value_table[i],local_scope_addr);
         nasal_vm.del_reference(value_addr);
     }
     return;